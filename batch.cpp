@@ -0,0 +1,109 @@
+#include "batch.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "profiler.hpp"
+
+using namespace std;
+
+Batch::Batch(int nThreads) {
+  m_nThreads =
+      nThreads > 0 ? nThreads : max(1, (int)thread::hardware_concurrency());
+  m_prefetch = 2 * m_nThreads;
+}
+
+string Batch::Stats::summary() const {
+  ostringstream out;
+  out.setf(ios::fixed);
+  out.precision(3);
+  out << nFiles << " files (" << nFailed << " failed) in " << seconds
+      << " s: " << filesPerSec() << " files/s, " << audioHoursPerSec()
+      << " audio hours/s";
+  return out.str();
+}
+
+Batch::Stats Batch::run(const vector<string> &fnames, const Job &job) {
+  PROFILE_SCOPE("Batch");
+  Stats stats;
+  mutex queueMutex;
+  condition_variable ready;
+  condition_variable space;
+  deque<pair<string, unique_ptr<Sound>>> queue;
+  bool loaded = false;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  // Parsing and sample conversion of the next files overlap the analyses;
+  // the queue bounds how far the loader runs ahead.
+  thread loader([&]() {
+    for (const string &fname : fnames) {
+      unique_ptr<Sound> sound(new Sound(fname));
+      unique_lock<mutex> lock(queueMutex);
+      space.wait(lock, [&]() { return (int)queue.size() < m_prefetch; });
+      queue.emplace_back(fname, move(sound));
+      ready.notify_one();
+    }
+    lock_guard<mutex> lock(queueMutex);
+    loaded = true;
+    ready.notify_all();
+  });
+  vector<thread> workers;
+  for (int t = 0; t < m_nThreads; t++) {
+    workers.emplace_back([&]() {
+      unique_ptr<Sound> prev;
+      for (;;) {
+        pair<string, unique_ptr<Sound>> item;
+        {
+          unique_lock<mutex> lock(queueMutex);
+          ready.wait(lock, [&]() { return !queue.empty() || loaded; });
+          if (queue.empty()) {
+            return;
+          }
+          item = move(queue.front());
+          queue.pop_front();
+          space.notify_one();
+        }
+        Sound &sound = *item.second;
+        bool ok = sound.loaded();
+        if (ok) {
+          if (prev) {
+            sound.reuseBuffers(*prev);
+          }
+          ok = job(item.first, sound);
+        }
+        {
+          lock_guard<mutex> lock(queueMutex);
+          stats.nFiles++;
+          if (ok) {
+            stats.audioSeconds += sound.duration();
+          } else {
+            stats.nFailed++;
+          }
+        }
+        prev = move(item.second);
+      }
+    });
+  }
+  loader.join();
+  for (thread &worker : workers) {
+    worker.join();
+  }
+  stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start)
+                      .count();
+  return stats;
+}
+
+Batch::Job Batch::analyzeJob(Sound::TFMethod method, int hopSize,
+                             Window::WindowType windowType, int windowSize,
+                             int nFFT, Sound::Precision precision) {
+  return [=](const string &, Sound &sound) {
+    sound.setFFTSize(nFFT ? nFFT : FFT::fastSize(windowSize));
+    sound.setPrecision(precision);
+    sound.analyze(method, hopSize, windowType, windowSize);
+    return sound.nFrames() > 0;
+  };
+}
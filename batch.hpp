@@ -0,0 +1,46 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "sound.hpp"
+
+using namespace std;
+
+// Runs a job over many files on a pool of workers. A loader thread reads
+// and converts the next files while the workers compute, and every worker
+// hands the spectrum storage of its previous file to the next one. FFT
+// plans and windows are shared between files through their caches.
+class Batch {
+ public:
+  // Called on a worker thread with a loaded sound; returns false on error.
+  typedef function<bool(const string &fname, Sound &sound)> Job;
+  struct Stats {
+    int nFiles = 0;
+    int nFailed = 0;
+    double seconds = 0.0;
+    double audioSeconds = 0.0;
+    double filesPerSec() const {
+      return seconds > 0.0 ? nFiles / seconds : 0.0;
+    }
+    double audioHoursPerSec() const {
+      return seconds > 0.0 ? audioSeconds / 3600.0 / seconds : 0.0;
+    }
+    string summary() const;
+  };
+  // 0 threads means one per hardware thread.
+  Batch(int nThreads = 0);
+  void setPrefetch(int nFiles) { m_prefetch = nFiles; }
+  Stats run(const vector<string> &fnames, const Job &job);
+  // A job running analyze() with the given settings. nFFT 0 keeps the
+  // window size.
+  static Job analyzeJob(Sound::TFMethod method, int hopSize,
+                        Window::WindowType windowType, int windowSize,
+                        int nFFT = 0,
+                        Sound::Precision precision = Sound::Double);
+
+ private:
+  int m_nThreads;
+  int m_prefetch;
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "profiler.hpp"
+
+using namespace std;
+
+// Owning, move-only array on cache-line boundaries. resize() keeps the
+// storage while it is large enough, so repeated analyses of a similar size
+// do not reach the allocator; the contents are unspecified after a resize.
+template <typename T>
+class AlignedBuffer {
+  static_assert(is_trivially_copyable<T>::value &&
+                    is_trivially_destructible<T>::value,
+                "AlignedBuffer holds plain data only");
+
+ public:
+  static constexpr size_t alignment = 64;
+  AlignedBuffer() = default;
+  explicit AlignedBuffer(size_t n) { resize(n); }
+  AlignedBuffer(const AlignedBuffer &) = delete;
+  AlignedBuffer &operator=(const AlignedBuffer &) = delete;
+  AlignedBuffer(AlignedBuffer &&other) noexcept { swap(other); }
+  AlignedBuffer &operator=(AlignedBuffer &&other) noexcept {
+    release();
+    swap(other);
+    return *this;
+  }
+  ~AlignedBuffer() { release(); }
+  void resize(size_t n) {
+    if (n > m_capacity) {
+      release();
+      m_data = static_cast<T *>(
+          ::operator new(n * sizeof(T), align_val_t(alignment)));
+      m_capacity = n;
+      Profiler::add(Profiler::BufferAlloc);
+    }
+    m_size = n;
+  }
+  void release() {
+    if (m_data) {
+      ::operator delete(m_data, align_val_t(alignment));
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_capacity = 0;
+  }
+  void swap(AlignedBuffer &other) noexcept {
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    std::swap(m_capacity, other.m_capacity);
+  }
+  T *data() { return m_data; }
+  const T *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  size_t bytes() const { return m_size * sizeof(T); }
+  T &operator[](size_t i) { return m_data[i]; }
+  const T &operator[](size_t i) const { return m_data[i]; }
+  T *begin() { return m_data; }
+  T *end() { return m_data + m_size; }
+
+ private:
+  T *m_data = nullptr;
+  size_t m_size = 0;
+  size_t m_capacity = 0;
+};
+
+// Monotonic allocator for the buffers of one analysis. alloc() bumps a
+// pointer through cache-line aligned chunks and nothing is freed on its
+// own: reset() recycles everything at once, merging the chunks so the next
+// pass of the same size fits in a single block, and release() returns the
+// memory. Only for plain data, which is never destroyed.
+class Arena {
+ public:
+  static constexpr size_t alignment = AlignedBuffer<char>::alignment;
+  static constexpr size_t minChunk = 1 << 16;
+  Arena() = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  Arena(Arena &&) = default;
+  Arena &operator=(Arena &&) = default;
+  template <typename T>
+  T *alloc(size_t n) {
+    static_assert(is_trivially_destructible<T>::value,
+                  "Arena holds plain data only");
+    return static_cast<T *>(allocBytes(n * sizeof(T)));
+  }
+  void *allocBytes(size_t bytes) {
+    bytes = (bytes + alignment - 1) / alignment * alignment;
+    if (m_chunks.empty() || m_offset + bytes > m_chunks.back().size()) {
+      size_t last = m_chunks.empty() ? 0 : m_chunks.back().size();
+      m_chunks.emplace_back(max(bytes, max(2 * last, minChunk)));
+      m_offset = 0;
+    }
+    void *p = m_chunks.back().data() + m_offset;
+    m_offset += bytes;
+    m_used += bytes;
+    return p;
+  }
+  void reset() {
+    if (m_chunks.size() > 1) {
+      size_t total = capacity();
+      m_chunks.clear();
+      m_chunks.emplace_back(total);
+    }
+    m_offset = 0;
+    m_used = 0;
+  }
+  void release() {
+    m_chunks.clear();
+    m_offset = 0;
+    m_used = 0;
+  }
+  size_t used() const { return m_used; }
+  size_t capacity() const {
+    size_t total = 0;
+    for (const AlignedBuffer<char> &chunk : m_chunks) {
+      total += chunk.size();
+    }
+    return total;
+  }
+
+ private:
+  vector<AlignedBuffer<char>> m_chunks;
+  size_t m_offset = 0;
+  size_t m_used = 0;
+};
+
+// nRows x nCols placed in an Arena, which owns the storage. Rows are padded
+// to the alignment so each starts on a cache line; rows() gives the T **
+// view the analysis code and its consumers index as m[i][k].
+template <typename T>
+class Matrix {
+ public:
+  void place(Arena &arena, int nRows, int nCols) {
+    size_t perLine = Arena::alignment / sizeof(T);
+    m_stride = perLine ? (nCols + perLine - 1) / perLine * perLine : nCols;
+    m_nRows = nRows;
+    m_nCols = nCols;
+    T *data = arena.alloc<T>((size_t)nRows * m_stride);
+    m_rows = arena.alloc<T *>(nRows);
+    for (int i = 0; i < nRows; i++) {
+      m_rows[i] = data + (size_t)i * m_stride;
+    }
+  }
+  void fill(const T &value) {
+    for (int i = 0; i < m_nRows; i++) {
+      for (int k = 0; k < m_nCols; k++) {
+        m_rows[i][k] = value;
+      }
+    }
+  }
+  // Forgets the rows; the arena still owns them.
+  void clear() {
+    m_rows = nullptr;
+    m_nRows = 0;
+    m_nCols = 0;
+  }
+  bool empty() const { return m_nRows == 0; }
+  int nRows() const { return m_nRows; }
+  int nCols() const { return m_nCols; }
+  size_t stride() const { return m_stride; }
+  size_t bytes() const { return (size_t)m_nRows * m_stride * sizeof(T); }
+  T **rows() { return m_nRows ? m_rows : nullptr; }
+  T *operator[](int i) { return m_rows[i]; }
+
+ private:
+  T **m_rows = nullptr;
+  size_t m_stride = 0;
+  int m_nRows = 0;
+  int m_nCols = 0;
+};
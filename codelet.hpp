@@ -0,0 +1,256 @@
+#pragma once
+
+#include <complex>
+#include <utility>
+
+using namespace std;
+
+// Fully unrolled transforms for the power-of-two sizes 32 .. 512. A
+// Codelet<T, N, S, V> is a radix-4 decimation in time over the N inputs
+// o, o + S, o + 2 S, ...: its four quarters are the inputs 4n + q, so the
+// strides replace the input permutation, and each stage is a fold over its
+// butterflies with the twiddles taken from constexpr tables. Every index is
+// a compile-time constant; nothing loops at run time. Sizes that are not a
+// power of 4 end in a radix-2 stage.
+//
+// Src supplies the inputs through load(i, &re, &im), which lets the window
+// and the conjugation of the inverse happen as the samples are read. The
+// stages work on separate real and imaginary arrays, which the compiler
+// packs into vectors a few butterflies at a time without shuffles; the
+// result is interleaved into the output once, at the end. The values are
+// of type V, T itself or CodeletLanes for several frames at once; the
+// twiddles are always T.
+
+// K frames side by side, the value type V of the codelets that
+// BasicFFT::execFrames() runs. The operators are element-wise loops over
+// the frames, which the compiler turns into vector operations once the
+// codelet is inlined.
+template <typename T, int K>
+struct CodeletLanes {
+  T v[K];
+  friend CodeletLanes operator+(const CodeletLanes &a, const CodeletLanes &b) {
+    CodeletLanes c;
+    for (int f = 0; f < K; f++) {
+      c.v[f] = a.v[f] + b.v[f];
+    }
+    return c;
+  }
+  friend CodeletLanes operator-(const CodeletLanes &a, const CodeletLanes &b) {
+    CodeletLanes c;
+    for (int f = 0; f < K; f++) {
+      c.v[f] = a.v[f] - b.v[f];
+    }
+    return c;
+  }
+  friend CodeletLanes operator-(const CodeletLanes &a) {
+    CodeletLanes c;
+    for (int f = 0; f < K; f++) {
+      c.v[f] = -a.v[f];
+    }
+    return c;
+  }
+  friend CodeletLanes operator*(const CodeletLanes &a, T w) {
+    CodeletLanes c;
+    for (int f = 0; f < K; f++) {
+      c.v[f] = a.v[f] * w;
+    }
+    return c;
+  }
+};
+
+// std::sin and std::cos are not constexpr. Taylor series in double, enough
+// terms to reach rounding for angles up to 2 pi.
+constexpr double codeletSin(double a) {
+  double term = a;
+  double sum = a;
+  for (int i = 1; i < 30; i++) {
+    term *= -a * a / ((2 * i) * (2 * i + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+constexpr double codeletCos(double a) {
+  double term = 1.0;
+  double sum = 1.0;
+  for (int i = 1; i < 30; i++) {
+    term *= -a * a / ((2 * i - 1) * (2 * i));
+    sum += term;
+  }
+  return sum;
+}
+
+// exp(-2 pi i k / N) for k < N.
+template <typename T, int N>
+struct CodeletTwiddles {
+  T re[N];
+  T im[N];
+  constexpr CodeletTwiddles() : re(), im() {
+    for (int k = 0; k < N; k++) {
+      double a = 2.0 * 3.14159265358979323846 * k / N;
+      re[k] = (T)codeletCos(a);
+      im[k] = (T)-codeletSin(a);
+    }
+  }
+};
+
+template <typename T, int N, int S, typename V = T>
+struct Codelet {
+  template <typename Src>
+  static void run(const Src &src, int o, V *re, V *im) {
+    if constexpr (N > inlineMax) {
+      runOutOfLine(src, o, re, im);
+    } else {
+      runInline(src, o, re, im);
+    }
+  }
+
+ private:
+  static constexpr int M = N / 4;
+  // The quarters call the same function, so every stage is emitted once;
+  // inlined all the way down, 512 points would take several times the
+  // instruction cache.
+  static constexpr int inlineMax = 64;
+  template <typename Src>
+  [[gnu::noinline]] static void runOutOfLine(const Src &src, int o, V *re,
+                                             V *im) {
+    runInline(src, o, re, im);
+  }
+  template <typename Src>
+  static void runInline(const Src &src, int o, V *re, V *im) {
+    for_quarters(src, o, re, im, make_index_sequence<4>());
+    combine(re, im, make_index_sequence<M>());
+  }
+  template <typename Src, size_t... Q>
+  static void for_quarters(const Src &src, int o, V *re, V *im,
+                           index_sequence<Q...>) {
+    (Codelet<T, M, 4 * S, V>::run(src, o + Q * S, re + Q * M, im + Q * M),
+     ...);
+  }
+  template <size_t... K>
+  static void combine(V *re, V *im, index_sequence<K...>) {
+    (butterfly<K>(re, im), ...);
+  }
+  // (r, i) *= exp(-2 pi i E / N); the multiples of a quarter turn only move
+  // components.
+  template <size_t E>
+  static void rotate(V &r, V &i) {
+    if constexpr (E == 0) {
+    } else if constexpr (4 * E == N) {
+      V t = r;
+      r = i;
+      i = -t;
+    } else if constexpr (2 * E == N) {
+      r = -r;
+      i = -i;
+    } else if constexpr (4 * E == 3 * N) {
+      V t = r;
+      r = -i;
+      i = t;
+    } else {
+      constexpr T wr = twiddles.re[E];
+      constexpr T wi = twiddles.im[E];
+      V t = r * wr - i * wi;
+      i = r * wi + i * wr;
+      r = t;
+    }
+  }
+  // Outputs K, K + M, K + 2 M and K + 3 M from bin K of the four quarters.
+  template <size_t K>
+  static void butterfly(V *re, V *im) {
+    V ar = re[K];
+    V ai = im[K];
+    V br = re[K + M];
+    V bi = im[K + M];
+    V cr = re[K + 2 * M];
+    V ci = im[K + 2 * M];
+    V dr = re[K + 3 * M];
+    V di = im[K + 3 * M];
+    rotate<K>(br, bi);
+    rotate<2 * K>(cr, ci);
+    rotate<3 * K>(dr, di);
+    V t0r = ar + cr;
+    V t0i = ai + ci;
+    V t1r = ar - cr;
+    V t1i = ai - ci;
+    V t2r = br + dr;
+    V t2i = bi + di;
+    // -i (b - d)
+    V t3r = bi - di;
+    V t3i = dr - br;
+    re[K] = t0r + t2r;
+    im[K] = t0i + t2i;
+    re[K + M] = t1r + t3r;
+    im[K + M] = t1i + t3i;
+    re[K + 2 * M] = t0r - t2r;
+    im[K + 2 * M] = t0i - t2i;
+    re[K + 3 * M] = t1r - t3r;
+    im[K + 3 * M] = t1i - t3i;
+  }
+  static constexpr CodeletTwiddles<T, N> twiddles{};
+};
+
+template <typename T, int S, typename V>
+struct Codelet<T, 2, S, V> {
+  template <typename Src>
+  static void run(const Src &src, int o, V *re, V *im) {
+    V ar;
+    V ai;
+    V br;
+    V bi;
+    src.load(o, &ar, &ai);
+    src.load(o + S, &br, &bi);
+    re[0] = ar + br;
+    im[0] = ai + bi;
+    re[1] = ar - br;
+    im[1] = ai - bi;
+  }
+};
+
+template <typename T, int S, typename V>
+struct Codelet<T, 1, S, V> {
+  template <typename Src>
+  static void run(const Src &src, int o, V *re, V *im) {
+    src.load(o, re, im);
+  }
+};
+
+// Runs the codelet of size nFFT on re and im, nFFT values of V each;
+// false when there is none.
+template <typename T, typename V, typename Src>
+bool runCodelet(int nFFT, const Src &src, V *re, V *im) {
+  switch (nFFT) {
+    case 32:
+      Codelet<T, 32, 1, V>::run(src, 0, re, im);
+      return true;
+    case 64:
+      Codelet<T, 64, 1, V>::run(src, 0, re, im);
+      return true;
+    case 128:
+      Codelet<T, 128, 1, V>::run(src, 0, re, im);
+      return true;
+    case 256:
+      Codelet<T, 256, 1, V>::run(src, 0, re, im);
+      return true;
+    case 512:
+      Codelet<T, 512, 1, V>::run(src, 0, re, im);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Runs the codelet of size nFFT into out, with scratch for 2 nFFT values
+// of T; false when there is none.
+template <typename T, typename Src>
+bool runCodelet(int nFFT, const Src &src, complex<T> *out, T *scratch) {
+  T *re = scratch;
+  T *im = scratch + nFFT;
+  if (!runCodelet<T>(nFFT, src, re, im)) {
+    return false;
+  }
+  for (int k = 0; k < nFFT; k++) {
+    out[k] = complex<T>(re[k], im[k]);
+  }
+  return true;
+}
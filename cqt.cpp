@@ -0,0 +1,182 @@
+#include "cqt.hpp"
+
+#include <QtMath>
+#include <algorithm>
+#include <thread>
+
+using namespace std;
+
+// Bins above this fraction of the (decimated) sample rate are handled at
+// the next higher rate, so every decimated octave lies in [0.2, 0.4) of its
+// rate and the half-band filter has room for its transition band.
+static const double octaveTop = 0.4;
+static const double sparseThreshold = 0.0054;
+static const double morletOmega = 6.0;
+static const int nDecimTaps = 65;
+
+CQT::CQT(double fs, double fMin, int binsPerOctave, Kernel kernel) {
+  m_fs = fs;
+  m_fMin = fMin;
+  m_binsPerOctave = binsPerOctave;
+  m_kernel = kernel;
+  m_nBins = floor(binsPerOctave * log2(0.45 * fs / fMin)) + 1;
+  int lastBin = m_nBins;
+  int decimation = 1;
+  while (lastBin > 0) {
+    Octave oct;
+    oct.decimation = decimation;
+    double fLow = octaveTop / 2.0 * fs / decimation;
+    int firstBin = max(0, (int)ceil(binsPerOctave * log2(fLow / fMin)));
+    oct.firstBin = firstBin;
+    genKernels(oct, lastBin);
+    m_octaves.push_back(move(oct));
+    lastBin = firstBin;
+    decimation *= 2;
+  }
+}
+
+void CQT::genKernels(Octave &oct, int lastBin) {
+  double fs = m_fs / oct.decimation;
+  double q = 1.0 / (pow(2.0, 1.0 / m_binsPerOctave) - 1.0);
+  vector<int> lengths;
+  int maxLength = 1;
+  for (int k = oct.firstBin; k < lastBin; k++) {
+    double f = binFreq(k) / fs;
+    int len = m_kernel == Morlet ? ceil(8.0 * morletOmega / (2.0 * M_PI * f))
+                                 : ceil(q / f);
+    lengths.push_back(len);
+    maxLength = max(maxLength, len);
+  }
+  oct.nFFT = 1;
+  while (oct.nFFT < maxLength) {
+    oct.nFFT *= 2;
+  }
+  oct.fft.reset(new FFT(oct.nFFT, Window::WindowType::Rect, fs));
+  int nFFT = oct.nFFT;
+  vector<double> re(nFFT), im(nFFT);
+  vector<complex<double>> specRe(nFFT), specIm(nFFT), spec(nFFT);
+  for (int k = oct.firstBin; k < lastBin; k++) {
+    double f = binFreq(k) / fs;
+    int len = lengths[k - oct.firstBin];
+    double sum = 0.0;
+    fill(re.begin(), re.end(), 0.0);
+    fill(im.begin(), im.end(), 0.0);
+    for (int n = 0; n < len; n++) {
+      double t = n - len / 2.0;
+      double w;
+      if (m_kernel == Morlet) {
+        double sigma = morletOmega / (2.0 * M_PI * f);
+        w = exp(-0.5 * t * t / (sigma * sigma));
+      } else {
+        w = 0.5 - 0.5 * cos(2.0 * M_PI * n / len);
+      }
+      int idx = nFFT / 2 - len / 2 + n;
+      re[idx] = w * cos(2.0 * M_PI * f * (idx - nFFT / 2));
+      im[idx] = w * sin(2.0 * M_PI * f * (idx - nFFT / 2));
+      sum += w;
+    }
+    oct.fft->transform(re.data(), specRe.data());
+    oct.fft->transform(im.data(), specIm.data());
+    double peak = 0.0;
+    for (int j = 0; j < nFFT; j++) {
+      spec[j] = (specRe[j] + 1.0i * specIm[j]) / sum;
+      peak = max(peak, abs(spec[j]));
+    }
+    vector<Entry> kernel;
+    for (int j = 0; j < nFFT; j++) {
+      if (abs(spec[j]) >= sparseThreshold * peak) {
+        kernel.push_back({j, conj(spec[j]) / (double)nFFT});
+      }
+    }
+    oct.kernels.push_back(kernel);
+  }
+}
+
+// Half-band low-pass: Blackman-windowed sinc.
+static vector<double> genDecimTaps() {
+  vector<double> taps(nDecimTaps);
+  double sum = 0.0;
+  for (int t = 0; t < nDecimTaps; t++) {
+    double m = t - (nDecimTaps - 1) / 2.0;
+    double sinc = m == 0.0 ? 1.0 : sin(M_PI * m / 2.0) / (M_PI * m / 2.0);
+    double w = 0.42 - 0.5 * cos(2.0 * M_PI * t / (nDecimTaps - 1)) +
+               0.08 * cos(4.0 * M_PI * t / (nDecimTaps - 1));
+    taps[t] = sinc * w;
+    sum += taps[t];
+  }
+  for (double &tap : taps) {
+    tap /= sum;
+  }
+  return taps;
+}
+
+void CQT::decimate(const vector<double> &x, vector<double> &y) {
+  static const vector<double> taps = genDecimTaps();
+  int nx = x.size();
+  y.assign(nx / 2, 0.0);
+  for (int m = 0; m < (int)y.size(); m++) {
+    double acc = 0.0;
+    for (int t = 0; t < nDecimTaps; t++) {
+      int n = 2 * m + t - (nDecimTaps - 1) / 2;
+      if (n >= 0 && n < nx) {
+        acc += taps[t] * x[n];
+      }
+    }
+    y[m] = acc;
+  }
+}
+
+void CQT::runOctave(Octave &oct, const vector<double> &x, int pad,
+                    int hopSize, int nFrames, complex<double> **spec) {
+  int nFFT = oct.nFFT;
+  vector<double> frame(nFFT);
+  vector<complex<double>> out(nFFT);
+  int nx = x.size();
+  for (int i = 0; i < nFrames; i++) {
+    long center = ((long)i * hopSize + oct.decimation / 2) / oct.decimation;
+    long start = center + pad - nFFT / 2;
+    for (int n = 0; n < nFFT; n++) {
+      long idx = start + n;
+      frame[n] = idx >= 0 && idx < nx ? x[idx] : 0.0;
+    }
+    oct.fft->transform(frame.data(), out.data());
+    for (int b = 0; b < (int)oct.kernels.size(); b++) {
+      complex<double> acc = 0.0;
+      for (const Entry &e : oct.kernels[b]) {
+        acc += out[e.idx] * e.val;
+      }
+      spec[i][oct.firstBin + b] = acc;
+    }
+  }
+}
+
+void CQT::exec(const double *x, int nSamples, int hopSize, int nFrames,
+               complex<double> **spec) {
+  // Every stage gets its own zero-padded copy of the signal at its rate;
+  // the stages write disjoint bins and run in parallel.
+  int pad = 0;
+  for (Octave &oct : m_octaves) {
+    pad = max(pad, oct.nFFT / 2);
+  }
+  vector<vector<double>> signals(m_octaves.size());
+  vector<double> cur(x, x + nSamples);
+  vector<double> next;
+  for (int o = 0; o < (int)m_octaves.size(); o++) {
+    signals[o].assign(pad, 0.0);
+    signals[o].insert(signals[o].end(), cur.begin(), cur.end());
+    signals[o].insert(signals[o].end(), pad, 0.0);
+    if (o + 1 < (int)m_octaves.size()) {
+      decimate(cur, next);
+      cur.swap(next);
+    }
+  }
+  vector<thread> workers;
+  for (int o = 0; o < (int)m_octaves.size(); o++) {
+    workers.emplace_back([&, o]() {
+      runOctave(m_octaves[o], signals[o], pad, hopSize, nFrames, spec);
+    });
+  }
+  for (thread &worker : workers) {
+    worker.join();
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <complex>
+#include <memory>
+#include <vector>
+
+#include "fft.hpp"
+
+using namespace std;
+
+// Constant-Q transform with the sparse spectral kernel method of Brown and
+// Puckette, computed octave by octave on a successively decimated signal
+// (Schoerkhuber and Klapuri). The Morlet kernel turns it into a sampled
+// continuous wavelet transform on the same log-frequency grid.
+class CQT {
+ public:
+  enum Kernel { Hann, Morlet };
+  CQT(double fs, double fMin, int binsPerOctave, Kernel kernel);
+  int nBins() { return m_nBins; }
+  double fMin() { return m_fMin; }
+  int binsPerOctave() { return m_binsPerOctave; }
+  Kernel kernel() { return m_kernel; }
+  double binFreq(int k) {
+    return m_fMin * pow(2.0, (double)k / m_binsPerOctave);
+  }
+  // x holds nSamples samples. spec[i][k] receives bin k of the frame
+  // centred on sample i * hopSize.
+  void exec(const double *x, int nSamples, int hopSize, int nFrames,
+            complex<double> **spec);
+
+ private:
+  struct Entry {
+    int idx;
+    complex<double> val;
+  };
+  // Bins sharing one decimation stage.
+  struct Octave {
+    int decimation;
+    int nFFT;
+    int firstBin;
+    unique_ptr<FFT> fft;
+    vector<vector<Entry>> kernels;
+  };
+  void genKernels(Octave &oct, int lastBin);
+  void runOctave(Octave &oct, const vector<double> &x, int pad, int hopSize,
+                 int nFrames, complex<double> **spec);
+  static void decimate(const vector<double> &x, vector<double> &y);
+  double m_fs;
+  double m_fMin;
+  int m_binsPerOctave;
+  Kernel m_kernel;
+  int m_nBins;
+  vector<Octave> m_octaves;
+};
@@ -0,0 +1,207 @@
+#include "events.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+#include "decibel.hpp"
+#include "fft.hpp"
+#include "profiler.hpp"
+
+// Frame i is centred on sample i * hop, about 21 ms long with half-frame
+// hops. Flux is the mean rise of the bin levels from the previous frame,
+// with levels floored at fluxFloor_dB so noise near silence does not count.
+// An onset is a flux peak over the mean of the delay frames around it by
+// more than both fluxDelta and fluxGain times the long-term mean, which
+// follows the background. Loud passages start when the level of the middle
+// hop of a frame clears the floor by loudOn_dB and end below loudOff_dB;
+// the floor follows the level down at once and up by floorRise_dB a
+// second, so it settles on the quiet parts.
+bool EventIndex::detect(const int16_t *x, int nSamples, int fs,
+                        const atomic<bool> *stop, atomic<int> *nDone) {
+  PROFILE_SCOPE("Event detection");
+  static const float fluxFloor_dB = -80.0f;
+  static const float fluxDelta = 0.5f;
+  static const float fluxGain = 0.5f;
+  static const int peakHalfWidth = 3;
+  static const double loudOn_dB = 20.0;
+  static const double loudOff_dB = 14.0;
+  static const double floorRise_dB = 1.0;
+  static const double floorMin_dB = -100.0;
+  m_events.clear();
+  m_nSamples = nSamples;
+  m_fs = fs;
+  int nFFT = BasicFFT<float>::fastSize(max((int)(0.021 * fs), 64));
+  int hop = nFFT / 2;
+  int nBins = nFFT / 2;
+  int nFrames = nSamples / hop + 1;
+  int delay = max((int)ceil(0.1 * fs / hop), peakHalfWidth);
+  int minGap = max((int)ceil(0.05 * fs / hop), 1);
+  // Long-term mean over about 10 s.
+  double slowRate = min((double)hop / fs / 10.0, 1.0);
+  double rise_dB = floorRise_dB * hop / fs;
+  BasicFFT<float> fft(nFFT, Window::WindowType::Hann, fs);
+  AlignedBuffer<float> in(nFFT);
+  AlignedBuffer<complex<float>> X(nFFT);
+  AlignedBuffer<float> dB(nBins);
+  AlignedBuffer<float> prev(nBins);
+  fill(prev.begin(), prev.end(), fluxFloor_dB);
+  // Flux of frames i - 2 delay .. i, the window of the local mean of the
+  // frame being decided.
+  vector<float> ring(2 * delay + 1, 0.0f);
+  int nRing = ring.size();
+  double ringSum = 0.0;
+  double slowMean = 0.0;
+  double floor_dB = 0.0;
+  bool loud = false;
+  int lastOnset = INT_MIN / 2;
+  for (int i = 0; i < nFrames + delay; i++) {
+    if (stop && *stop) {
+      m_events.clear();
+      return false;
+    }
+    float flux = 0.0f;
+    if (i < nFrames) {
+      int p = i * hop - nFFT / 2;
+      for (int n = 0; n < nFFT; n++) {
+        int s = p + n;
+        in[n] = s >= 0 && s < nSamples ? x[s] / (SHRT_MAX + 1.0f) : 0.0f;
+      }
+      fft.exec(in.data(), X.data());
+      float lo;
+      float hi;
+      power2dB(X.data(), nBins, dB.data(), &lo, &hi);
+      float sum = 0.0f;
+      for (int k = 0; k < nBins; k++) {
+        float level = max(dB[k], fluxFloor_dB);
+        sum += max(level - prev[k], 0.0f);
+        prev[k] = level;
+      }
+      flux = i ? sum / nBins : 0.0f;
+      slowMean += slowRate * (flux - slowMean);
+      double power = 0.0;
+      for (int n = nFFT / 4; n < nFFT / 4 + hop; n++) {
+        power += in[n] * in[n];
+      }
+      double level_dB = 10.0 * log10(power / hop + 1e-30);
+      floor_dB = i ? min(floor_dB + rise_dB, level_dB) : level_dB;
+      floor_dB = max(floor_dB, floorMin_dB);
+      double time = (double)i * hop / fs;
+      if (!loud && level_dB > floor_dB + loudOn_dB) {
+        loud = true;
+        m_events.push_back({time, Loud, (float)(level_dB - floor_dB)});
+      } else if (loud && level_dB < floor_dB + loudOff_dB) {
+        loud = false;
+      }
+      if (nDone) {
+        *nDone = min((i + 1) * hop, nSamples);
+      }
+    }
+    ringSum += flux - ring[i % nRing];
+    ring[i % nRing] = flux;
+    // Frame c has delay frames of flux on either side by now; frames past
+    // the end read as zero.
+    int c = i - delay;
+    if (c < 1) {
+      continue;
+    }
+    float peak = ring[c % nRing];
+    bool isPeak = true;
+    for (int d = 1; d <= peakHalfWidth && isPeak; d++) {
+      isPeak = peak > ring[(c - d + nRing) % nRing] &&
+               peak >= ring[(c + d) % nRing];
+    }
+    double threshold =
+        ringSum / nRing + max((double)fluxDelta, fluxGain * slowMean);
+    if (isPeak && peak > threshold && c - lastOnset >= minGap) {
+      m_events.push_back({(double)c * hop / fs, Onset, peak});
+      lastOnset = c;
+    }
+  }
+  // Onsets are decided delay frames late.
+  stable_sort(m_events.begin(), m_events.end(),
+              [](const Event &a, const Event &b) { return a.time < b.time; });
+  return true;
+}
+
+bool EventIndex::save(const string &fname) const {
+  ofstream fout(fname);
+  if (!fout) {
+    cerr << "Cannot write " << fname << endl;
+    return false;
+  }
+  fout << "tfy events 1\n";
+  fout << "fs " << m_fs << "\n";
+  fout << "samples " << m_nSamples << "\n";
+  fout.precision(9);
+  for (const Event &e : m_events) {
+    fout << (e.kind == Onset ? "onset " : "loud ") << e.time << " "
+         << e.strength << "\n";
+  }
+  return (bool)fout;
+}
+
+bool EventIndex::load(const string &fname, int nSamples, int fs) {
+  ifstream fin(fname);
+  if (!fin) {
+    return false;
+  }
+  string tag;
+  string kind;
+  int version = 0;
+  int fileFs = 0;
+  int fileSamples = 0;
+  fin >> tag >> kind >> version;
+  if (tag != "tfy" || kind != "events" || version != 1) {
+    cerr << fname << " is not an event index." << endl;
+    return false;
+  }
+  fin >> tag >> fileFs;
+  fin >> kind >> fileSamples;
+  if (!fin || fileFs != fs || fileSamples != nSamples) {
+    return false;
+  }
+  vector<Event> events;
+  Event e;
+  while (fin >> kind >> e.time >> e.strength) {
+    e.kind = kind == "onset" ? Onset : Loud;
+    events.push_back(e);
+  }
+  if (!fin.eof()) {
+    cerr << "Broken event index: " << fname << endl;
+    return false;
+  }
+  m_events.swap(events);
+  m_nSamples = nSamples;
+  m_fs = fs;
+  return true;
+}
+
+int EventIndex::next(double t) const {
+  auto it = upper_bound(
+      m_events.begin(), m_events.end(), t,
+      [](double t, const Event &e) { return t + 1e-6 < e.time; });
+  return it == m_events.end() ? -1 : (int)(it - m_events.begin());
+}
+
+int EventIndex::previous(double t) const {
+  auto it = lower_bound(
+      m_events.begin(), m_events.end(), t,
+      [](const Event &e, double t) { return e.time < t - 1e-6; });
+  return it == m_events.begin() ? -1 : (int)(it - m_events.begin()) - 1;
+}
+
+EventDetector::EventDetector(const int16_t *x, int nSamples, int fs) {
+  m_nSamples = nSamples;
+  m_worker = thread([this, x, nSamples, fs] {
+    m_index.detect(x, nSamples, fs, &m_stop, &m_nDone);
+    m_finished = true;
+  });
+}
+
+EventDetector::~EventDetector() {
+  m_stop = true;
+  m_worker.join();
+}
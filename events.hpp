@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Where things happen in a recording, sorted by time: onsets, from peaks of
+// the spectral flux over an adaptive threshold, and the starts of loud
+// passages, from the frame level against a tracked noise floor. detect()
+// streams one STFT frame at a time and keeps a fraction of a second of
+// flux, so its memory does not grow with the length of the file.
+class EventIndex {
+ public:
+  enum Kind { Onset, Loud };
+  struct Event {
+    double time;
+    Kind kind;
+    // Flux in dB per bin for onsets, dB above the floor for loud passages.
+    float strength;
+  };
+  // Replaces the index with the events of nSamples 16-bit samples. Returns
+  // false, leaving it empty, once *stop is set; *nDone counts the samples
+  // analysed so far.
+  bool detect(const int16_t *x, int nSamples, int fs,
+              const atomic<bool> *stop = nullptr,
+              atomic<int> *nDone = nullptr);
+  // The index lives beside the sound file; load() refuses one written for
+  // a file of another length or rate.
+  static string sidecar(const string &fname) { return fname + ".events"; }
+  bool save(const string &fname) const;
+  bool load(const string &fname, int nSamples, int fs);
+  const vector<Event> &events() const { return m_events; }
+  // First event after t, or -1.
+  int next(double t) const;
+  // Last event before t, or -1.
+  int previous(double t) const;
+
+ private:
+  vector<Event> m_events;
+  int m_nSamples = 0;
+  int m_fs = 0;
+};
+
+// Runs EventIndex::detect() on a worker thread. x must outlive the object.
+class EventDetector {
+ public:
+  EventDetector(const int16_t *x, int nSamples, int fs);
+  EventDetector(const EventDetector &) = delete;
+  EventDetector &operator=(const EventDetector &) = delete;
+  ~EventDetector();
+  bool finished() { return m_finished; }
+  double progress() { return m_nSamples ? (double)m_nDone / m_nSamples : 1.0; }
+  // Valid once finished().
+  const EventIndex &index() { return m_index; }
+
+ private:
+  EventIndex m_index;
+  int m_nSamples;
+  atomic<int> m_nDone{0};
+  atomic<bool> m_stop{false};
+  atomic<bool> m_finished{false};
+  thread m_worker;
+};
@@ -0,0 +1,327 @@
+#include "exporter.hpp"
+
+#include <QImage>
+#include <QtMath>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "mel.hpp"
+#include "profiler.hpp"
+
+using namespace std;
+
+static string baseName(const string &path) {
+  size_t slash = path.find_last_of("/\\");
+  return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+static const char *windowName(Window::WindowType type) {
+  switch (type) {
+    case Window::WindowType::Gaussian:
+      return "gaussian";
+    case Window::WindowType::Hann:
+      return "hann";
+    case Window::WindowType::Hamming:
+      return "hamming";
+    case Window::WindowType::Rect:
+      return "rect";
+    default:
+      return "unknown";
+  }
+}
+
+Exporter::Exporter(Sound *sound) {
+  m_sound = sound;
+  for (int f = 0; f < Features::NumFeature; f++) {
+    m_featureSet.setEnabled((Features::Feature)f, true);
+  }
+}
+
+const char *Exporter::extension(Format format) {
+  switch (format) {
+    case Format::Raw:
+      return ".f32";
+    case Format::PngTiles:
+      return ".png";
+    default:
+      return ".npy";
+  }
+}
+
+// The .npy header is padded so the data starts on a 64-byte boundary, which
+// lets np.load(mmap_mode='r') map it directly. Filterbank and peaks stay
+// .npy in the PNG tile format.
+bool Exporter::openArray(ArrayFile &file, const string &base,
+                         const char *suffix, int nRows, int nCols) {
+  bool npy = m_format != Format::Raw;
+  file.name = base + suffix + (npy ? ".npy" : ".f32");
+  file.out.open(file.name, ios::out | ios::binary | ios::trunc);
+  if (!file.out) {
+    cerr << "Cannot open file: " << file.name << endl;
+    return false;
+  }
+  if (npy) {
+    ostringstream dict;
+    dict << "{'descr': '<f4', 'fortran_order': False, 'shape': (" << nRows
+         << ", " << nCols << "), }";
+    string header = dict.str();
+    size_t total = 10 + header.size() + 1;
+    header.append((64 - total % 64) % 64, ' ');
+    header += '\n';
+    unsigned short len = header.size();
+    file.out.write("\x93NUMPY\x01\x00", 8);
+    char lenBytes[2] = {(char)(len & 0xff), (char)(len >> 8)};
+    file.out.write(lenBytes, 2);
+    file.out.write(header.data(), header.size());
+  }
+  return true;
+}
+
+// Triangular filters evenly spaced on the mel scale from 0 to fs / 2,
+// normalized to unit area so band energies are comparable.
+void Exporter::genFilterbank(int nFFT) {
+  m_bands.clear();
+  double fs = m_sound->fs();
+  int nBins = nFFT / 2;
+  double melHi = hz2mel(fs / 2.0);
+  vector<double> edges(m_nBands + 2);
+  for (int b = 0; b < m_nBands + 2; b++) {
+    edges[b] = mel2hz(melHi * b / (m_nBands + 1)) / fs * nFFT;
+  }
+  for (int b = 0; b < m_nBands; b++) {
+    Band band;
+    band.firstBin = max(0, (int)ceil(edges[b]));
+    int lastBin = min(nBins - 1, (int)floor(edges[b + 2]));
+    double sum = 0.0;
+    for (int k = band.firstBin; k <= lastBin; k++) {
+      double w = k < edges[b + 1]
+                     ? (k - edges[b]) / (edges[b + 1] - edges[b])
+                     : (edges[b + 2] - k) / (edges[b + 2] - edges[b + 1]);
+      band.weights.push_back(max(w, 0.0));
+      sum += max(w, 0.0);
+    }
+    if (band.weights.empty()) {
+      // Narrower than a bin: take the nearest one.
+      band.firstBin = min(nBins - 1, (int)(edges[b + 1] + 0.5));
+      band.weights.push_back(1.0f);
+      sum = 1.0;
+    }
+    for (float &w : band.weights) {
+      w /= sum;
+    }
+    m_bands.push_back(band);
+  }
+}
+
+// Samples within half a hop of the frame centre.
+void Exporter::framePeaks(int i, int hopSize, float *minMax) {
+  const double *x = m_sound->x() + m_sound->nMargin();
+  long begin = max((long)i * hopSize - hopSize / 2, 0L);
+  long end = min((long)i * hopSize + (hopSize + 1) / 2,
+                 (long)m_sound->nSamples());
+  double lo = 0.0, hi = 0.0;
+  for (long n = begin; n < end; n++) {
+    lo = n == begin ? x[n] : min(lo, x[n]);
+    hi = n == begin ? x[n] : max(hi, x[n]);
+  }
+  minMax[0] = lo;
+  minMax[1] = hi;
+}
+
+bool Exporter::exportSTFT(const string &base, int hopSize,
+                          Window::WindowType windowType, int windowSize) {
+  PROFILE_SCOPE("Export");
+  int nFFT = m_sound->fft()->nFFT();
+  int nBins = nFFT / 2;
+  int nFrames = m_sound->nSamples() / hopSize;
+  bool tiles = m_format == Format::PngTiles;
+  m_spec.name.clear();
+  m_fbank.name.clear();
+  m_peakFile.name.clear();
+  m_featureFile.name.clear();
+  if (!tiles && !openArray(m_spec, base, "_spec", nFrames, nBins)) {
+    return false;
+  }
+  if (m_nBands > 0) {
+    genFilterbank(nFFT);
+    if (!openArray(m_fbank, base, "_fbank", nFrames, m_nBands)) {
+      return false;
+    }
+  }
+  if (m_peaks && !openArray(m_peakFile, base, "_peaks", nFrames, 2)) {
+    return false;
+  }
+  bool features = m_featureSet.anyEnabled();
+  vector<double> pow, prevMag;
+  vector<float> featureRow;
+  if (features) {
+    m_featureSet.clear();
+    m_sound->fft()->setWindow(windowType, windowSize);
+    m_featureSet.configure(m_sound->fft(), m_sound->fs());
+    pow.resize(nBins);
+    prevMag.resize(nBins);
+    featureRow.resize(m_featureSet.nColumns());
+    if (!openArray(m_featureFile, base, "_features", nFrames,
+                   m_featureSet.nColumns())) {
+      return false;
+    }
+  }
+  int tileWidth = max(1, min(m_tileWidth, nFrames));
+  QImage tile;
+  if (tiles) {
+    tile = QImage(tileWidth, nBins, QImage::Format_RGB32);
+  }
+  int nTiles = 0;
+  bool ok = true;
+  vector<float> row(max(nBins, m_nBands));
+  auto saveTile = [&](int width) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "_spec_%05d.png", nTiles++);
+    string name = base + suffix;
+    QImage image = width < tile.width() ? tile.copy(0, 0, width, nBins) : tile;
+    if (!image.save(QString::fromStdString(name), "PNG")) {
+      cerr << "Cannot write tile: " << name << endl;
+      ok = false;
+    }
+  };
+  m_sound->streamSTFT(
+      hopSize, windowType, windowSize,
+      [&](int i, const complex<double> *X) {
+        if (!ok) {
+          return;
+        }
+        float lo;
+        float hi;
+        power2dB(X, nBins, row.data(), &lo, &hi);
+        if (tiles) {
+          int col = i % tileWidth;
+          double range = m_upper_dB - m_lower_dB;
+          for (int k = 0; k < nBins; k++) {
+            double v = range > 0.0 ? (row[k] - m_lower_dB) / range : 0.0;
+            v = min(max(v, 0.0), 1.0);
+            unsigned char r, g, b;
+            if (m_colormap) {
+              m_colormap(v, &r, &g, &b);
+            } else {
+              r = g = b = v * 255.0 + 0.5;
+            }
+            tile.setPixel(col, nBins - 1 - k, qRgb(r, g, b));
+          }
+          if (col == tileWidth - 1 || i == nFrames - 1) {
+            saveTile(col + 1);
+          }
+        } else {
+          m_spec.out.write((const char *)row.data(), nBins * sizeof(float));
+        }
+        if (m_nBands > 0) {
+          for (int b = 0; b < m_nBands; b++) {
+            const Band &band = m_bands[b];
+            double e = 0.0;
+            for (int j = 0; j < (int)band.weights.size(); j++) {
+              e += band.weights[j] * norm(X[band.firstBin + j]);
+            }
+            row[b] = 10.0 * log10(e);
+          }
+          m_fbank.out.write((const char *)row.data(), m_nBands * sizeof(float));
+        }
+        if (m_peaks) {
+          float minMax[2];
+          framePeaks(i, hopSize, minMax);
+          m_peakFile.out.write((const char *)minMax, sizeof(minMax));
+        }
+        if (features) {
+          m_featureSet.compute(featureRow.data(), X, pow.data(),
+                               prevMag.data(), i > 0);
+          m_featureFile.out.write((const char *)featureRow.data(),
+                                  featureRow.size() * sizeof(float));
+        }
+      });
+  for (ArrayFile *file : {&m_spec, &m_fbank, &m_peakFile, &m_featureFile}) {
+    if (file->out.is_open()) {
+      file->out.close();
+      if (!file->out) {
+        cerr << "Cannot write file: " << file->name << endl;
+        ok = false;
+      }
+    }
+  }
+  if (!ok) {
+    return false;
+  }
+  return writeSidecar(base, hopSize, windowType, windowSize, nFrames, nTiles);
+}
+
+bool Exporter::writeSidecar(const string &base, int hopSize,
+                            Window::WindowType windowType, int windowSize,
+                            int nFrames, int nTiles) {
+  string name = base + ".json";
+  ofstream fout(name);
+  if (!fout) {
+    cerr << "Cannot open file: " << name << endl;
+    return false;
+  }
+  int nFFT = m_sound->fft()->nFFT();
+  fout << "{\n"
+       << "  \"fs\": " << m_sound->fs() << ",\n"
+       << "  \"nSamples\": " << m_sound->nSamples() << ",\n"
+       << "  \"nFFT\": " << nFFT << ",\n"
+       << "  \"hop\": " << hopSize << ",\n"
+       << "  \"window\": \"" << windowName(windowType) << "\",\n"
+       << "  \"windowSize\": " << min(windowSize, nFFT) << ",\n"
+       << "  \"nFrames\": " << nFrames << ",\n"
+       << "  \"frameTime\": \"i * hop / fs, frame centre in seconds\",\n"
+       << "  \"binFreq\": \"k * fs / nFFT\",\n"
+       << "  \"arrays\": [";
+  bool first = true;
+  auto array = [&](const ArrayFile &file, const char *kind, int nCols,
+                   const char *scale) {
+    fout << (first ? "" : ",") << "\n    {\"kind\": \"" << kind
+         << "\", \"file\": \"" << baseName(file.name)
+         << "\", \"format\": \""
+         << (m_format == Format::Raw ? "raw" : "npy")
+         << "\", \"dtype\": \"<f4\", \"order\": \"C\", \"shape\": ["
+         << nFrames << ", " << nCols << "], \"scale\": \"" << scale << "\"";
+    if (!strcmp(kind, "filterbank")) {
+      fout << ", \"bands\": \"mel\", \"fMax\": " << m_sound->fs() / 2.0;
+    }
+    if (!strcmp(kind, "features")) {
+      fout << ", \"columns\": [";
+      for (int c = 0; c < nCols; c++) {
+        fout << (c ? ", " : "") << "\"" << m_featureSet.columnName(c) << "\"";
+      }
+      fout << "], \"units\": [";
+      for (int c = 0; c < nCols; c++) {
+        fout << (c ? ", " : "") << "\"" << m_featureSet.columnUnit(c) << "\"";
+      }
+      fout << "]";
+    }
+    fout << "}";
+    first = false;
+  };
+  if (!m_spec.name.empty()) {
+    array(m_spec, "spectrogram", nFFT / 2, "dB, 20 log10 |X| / window sum");
+  }
+  if (!m_fbank.name.empty()) {
+    array(m_fbank, "filterbank", m_nBands, "dB, 10 log10 band power");
+  }
+  if (!m_peakFile.name.empty()) {
+    array(m_peakFile, "peaks", 2, "linear min, max");
+  }
+  if (!m_featureFile.name.empty()) {
+    array(m_featureFile, "features", m_featureSet.nColumns(), "per column");
+  }
+  fout << "\n  ]";
+  if (nTiles) {
+    fout << ",\n  \"tiles\": {\"kind\": \"spectrogram\", \"pattern\": \""
+         << baseName(base) << "_spec_%05d.png\", \"count\": " << nTiles
+         << ", \"framesPerTile\": " << max(1, min(m_tileWidth, nFrames))
+         << ", \"height\": " << nFFT / 2 << ", \"lowerDB\": " << m_lower_dB
+         << ", \"upperDB\": " << m_upper_dB
+         << ", \"rowOrder\": \"top is fs / 2\"}";
+  }
+  fout << "\n}\n";
+  return (bool)fout;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "sound.hpp"
+
+using namespace std;
+
+// Writes analysis results to disk while the STFT runs, one frame at a time,
+// so the size of an export is not bounded by memory. Arrays are row-major
+// float32 with one row per frame, either as .npy or as headerless .f32 for
+// np.memmap; the spectrogram can also go out as PNG tiles. A JSON sidecar
+// <base>.json records shapes and the analysis parameters.
+class Exporter {
+ public:
+  enum Format { Npy, Raw, PngTiles, NumFormat };
+  typedef void (*Colormap)(double x, unsigned char *r, unsigned char *g,
+                           unsigned char *b);
+  Exporter(Sound *sound);
+  void setFormat(Format format) { m_format = format; }
+  // Mel bands of the filterbank array; 0 leaves it out.
+  void setFilterbankSize(int nBands) { m_nBands = nBands; }
+  // Per-frame waveform min and max.
+  void setPeaks(bool enabled) { m_peaks = enabled; }
+  // The per-frame features computed in the export pass; all of them unless
+  // changed here, whatever the sound computes for the view.
+  Features *features() { return &m_featureSet; }
+  // PNG tiles only. Frames per tile, level range and colours.
+  void setTileWidth(int nFrames) { m_tileWidth = nFrames; }
+  void setRange(double lower_dB, double upper_dB) {
+    m_lower_dB = lower_dB;
+    m_upper_dB = upper_dB;
+  }
+  void setColormap(Colormap colormap) { m_colormap = colormap; }
+  // base is the output path without extension. Uses the current FFT size
+  // of the sound.
+  bool exportSTFT(const string &base, int hopSize,
+                  Window::WindowType windowType, int windowSize);
+  static const char *extension(Format format);
+
+ private:
+  struct ArrayFile {
+    string name;
+    ofstream out;
+  };
+  struct Band {
+    int firstBin;
+    vector<float> weights;
+  };
+  bool openArray(ArrayFile &file, const string &base, const char *suffix,
+                 int nRows, int nCols);
+  void genFilterbank(int nFFT);
+  void framePeaks(int i, int hopSize, float *minMax);
+  bool writeSidecar(const string &base, int hopSize,
+                    Window::WindowType windowType, int windowSize,
+                    int nFrames, int nTiles);
+  Sound *m_sound;
+  Format m_format = Npy;
+  int m_nBands = 64;
+  bool m_peaks = true;
+  int m_tileWidth = 4096;
+  double m_lower_dB = -120.0;
+  double m_upper_dB = 0.0;
+  Colormap m_colormap = nullptr;
+  vector<Band> m_bands;
+  ArrayFile m_spec;
+  ArrayFile m_fbank;
+  ArrayFile m_peakFile;
+  ArrayFile m_featureFile;
+  Features m_featureSet;
+};
@@ -0,0 +1,215 @@
+#include "features.hpp"
+
+#include <QtMath>
+#include <algorithm>
+
+using namespace std;
+
+Features::Features() {
+  fill(m_enabled, m_enabled + NumFeature, false);
+  m_bandEdges = {0.0, 250.0, 500.0, 1000.0, 2000.0, 4000.0, 8000.0, 16000.0};
+  updateColumns();
+}
+
+void Features::setEnabled(Feature feature, bool enabled) {
+  m_enabled[feature] = enabled;
+  updateColumns();
+}
+
+void Features::setBandEdges(const vector<double> &edges) {
+  m_bandEdges = edges;
+  updateColumns();
+}
+
+void Features::updateColumns() {
+  m_nColumns = 0;
+  for (int f = 0; f < NumFeature; f++) {
+    m_column[f] = m_enabled[f] ? m_nColumns : -1;
+    if (m_enabled[f]) {
+      m_nColumns += f == Bands ? nBands() : 1;
+    }
+  }
+}
+
+bool Features::anyEnabled() { return m_nColumns > 0; }
+
+const char *Features::name(Feature feature) {
+  switch (feature) {
+    case Feature::RMS:
+      return "rms";
+    case Feature::Centroid:
+      return "centroid";
+    case Feature::Rolloff:
+      return "rolloff";
+    case Feature::Flatness:
+      return "flatness";
+    case Feature::Flux:
+      return "flux";
+    case Feature::Bands:
+      return "band";
+    default:
+      return "unknown";
+  }
+}
+
+const char *Features::unit(Feature feature) {
+  switch (feature) {
+    case Feature::RMS:
+    case Feature::Bands:
+      return "dB";
+    case Feature::Centroid:
+    case Feature::Rolloff:
+      return "Hz";
+    default:
+      return "";
+  }
+}
+
+Features::Feature Features::columnFeature(int c) {
+  for (int f = NumFeature - 1; f >= 0; f--) {
+    if (m_column[f] >= 0 && c >= m_column[f]) {
+      return (Feature)f;
+    }
+  }
+  return NumFeature;
+}
+
+string Features::columnName(int c) {
+  Feature f = columnFeature(c);
+  if (f != Bands) {
+    return f == NumFeature ? "" : name(f);
+  }
+  int b = c - m_column[f];
+  return string(name(Bands)) + "_" + to_string((int)m_bandEdges[b]) + "_" +
+         to_string((int)m_bandEdges[b + 1]);
+}
+
+const char *Features::columnUnit(int c) {
+  Feature f = columnFeature(c);
+  return f == NumFeature ? "" : unit(f);
+}
+
+// The STFT multiplies every frame by the window before exec() applies it
+// again, so frames are weighted by w^2 and normalized by the sum of w.
+// Parseval over the half spectrum then gives the weighted mean square as
+// rmsScale * sum |X|^2.
+template <typename T>
+void Features::configure(BasicFFT<T> *fft, double fs) {
+  int nFFT = fft->nFFT();
+  const T *w = fft->window()->data();
+  double area = fft->window()->area();
+  double energy = 0.0;
+  for (int n = 0; n < nFFT; n++) {
+    double h = (double)w[n] * w[n];
+    energy += h * h;
+  }
+  m_nBins = nFFT / 2;
+  m_fs = fs;
+  m_binHz = fs / nFFT;
+  m_rmsScale = energy > 0.0 ? 2.0 * area * area / (nFFT * energy) : 0.0;
+  m_bandBins.clear();
+  for (double edge : m_bandEdges) {
+    m_bandBins.push_back(min(max((int)(edge / m_binHz + 0.5), 0), m_nBins));
+  }
+}
+
+// Each reduction is a separate loop over contiguous doubles. The sums are
+// declared as omp simd reductions, which lets the compiler split them into
+// vector lanes; the order of the additions, and so the last bits of the
+// result, then follows the vector width. The flux takes the positive part
+// as (d + |d|) / 2, exact, because a select inside a reduction keeps GCC
+// from vectorizing. log() has no vector version without -ffast-math, so
+// the flatness loop stays scalar.
+template <typename T>
+void Features::compute(float *row, const complex<T> *X, double *pow,
+                       double *prevMag, bool hasPrev) {
+  static const double tiny = 1e-300;
+  int n = m_nBins;
+  for (int k = 0; k < n; k++) {
+    double re = X[k].real();
+    double im = X[k].imag();
+    pow[k] = re * re + im * im;
+  }
+  double total = 0.0;
+  double moment = 0.0;
+#pragma omp simd reduction(+ : total, moment)
+  for (int k = 0; k < n; k++) {
+    total += pow[k];
+    moment += k * pow[k];
+  }
+  if (m_column[RMS] >= 0) {
+    row[m_column[RMS]] = max(10.0 * log10(total * m_rmsScale), floor_dB);
+  }
+  if (m_column[Centroid] >= 0) {
+    row[m_column[Centroid]] = total > 0.0 ? moment / total * m_binHz : 0.0;
+  }
+  if (m_column[Rolloff] >= 0) {
+    double target = rolloffFraction * total;
+    double acc = 0.0;
+    int k = 0;
+    while (k < n - 1 && (acc += pow[k]) < target) {
+      k++;
+    }
+    row[m_column[Rolloff]] = k * m_binHz;
+  }
+  if (m_column[Flatness] >= 0) {
+    double logSum = 0.0;
+    for (int k = 0; k < n; k++) {
+      logSum += log(pow[k] + tiny);
+    }
+    double mean = total / n;
+    row[m_column[Flatness]] = mean > 0.0 ? exp(logSum / n) / mean : 0.0;
+  }
+  if (m_column[Flux] >= 0) {
+    double flux = 0.0;
+    if (hasPrev) {
+#pragma omp simd reduction(+ : flux)
+      for (int k = 0; k < n; k++) {
+        double mag = sqrt(pow[k]);
+        double d = mag - prevMag[k];
+        d = 0.5 * (d + fabs(d));
+        flux += d * d;
+        prevMag[k] = mag;
+      }
+    } else {
+      for (int k = 0; k < n; k++) {
+        prevMag[k] = sqrt(pow[k]);
+      }
+    }
+    row[m_column[Flux]] = sqrt(flux);
+  }
+  if (m_column[Bands] >= 0) {
+    for (int b = 0; b < nBands(); b++) {
+      double e = 0.0;
+#pragma omp simd reduction(+ : e)
+      for (int k = m_bandBins[b]; k < m_bandBins[b + 1]; k++) {
+        e += pow[k];
+      }
+      row[m_column[Bands] + b] = max(10.0 * log10(e * m_rmsScale), floor_dB);
+    }
+  }
+}
+
+template <typename S>
+void Features::fixFlux(int i, const complex<S> *prev, const complex<S> *cur) {
+  if (m_column[Flux] < 0) {
+    return;
+  }
+  double flux = 0.0;
+  for (int k = 0; k < m_nBins; k++) {
+    double d = max((double)abs(cur[k]) - abs(prev[k]), 0.0);
+    flux += d * d;
+  }
+  m_values[i][m_column[Flux]] = sqrt(flux);
+}
+
+template void Features::configure(BasicFFT<float> *fft, double fs);
+template void Features::configure(BasicFFT<double> *fft, double fs);
+template void Features::compute(float *row, const complex<float> *X,
+                                double *pow, double *prevMag, bool hasPrev);
+template void Features::compute(float *row, const complex<double> *X,
+                                double *pow, double *prevMag, bool hasPrev);
+template void Features::fixFlux(int i, const complex<float> *prev,
+                                const complex<float> *cur);
+template void Features::fixFlux(int i, const complex<double> *prev,
+                                const complex<double> *cur);
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cmath>
+#include <complex>
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+#include "fft.hpp"
+
+using namespace std;
+
+// Per-frame spectral descriptors, computed from each STFT frame while it
+// is still in cache instead of in a second pass. frame() only touches its
+// own row, so the threads of a parallel STFT call it for disjoint frames;
+// flux at the first frame of each thread's run is patched afterwards with
+// fixFlux(), from the stored spectrum.
+class Features {
+ public:
+  enum Feature { RMS, Centroid, Rolloff, Flatness, Flux, Bands, NumFeature };
+  // Nothing enabled.
+  Features();
+  // Level of zero energy, about where power2dB() puts it, so silent frames
+  // and empty bands export as numbers rather than -inf.
+  static constexpr double floor_dB = -382.0;
+  void setEnabled(Feature feature, bool enabled);
+  bool enabled(Feature feature) { return m_enabled[feature]; }
+  bool anyEnabled();
+  // Band energies between consecutive edges in Hz, clipped to fs / 2. A
+  // band that lies above fs / 2 is empty and reads as floor_dB.
+  void setBandEdges(const vector<double> &edges);
+  int nBands() {
+    return m_enabled[Bands] ? max((int)m_bandEdges.size() - 1, 0) : 0;
+  }
+  // Columns of the enabled features in Feature order; Bands takes nBands()
+  // columns. column() is -1 for a disabled feature.
+  int nColumns() { return m_nColumns; }
+  int column(Feature feature) { return m_column[feature]; }
+  string columnName(int c);
+  const char *columnUnit(int c);
+  static const char *name(Feature feature);
+  static const char *unit(Feature feature);
+  // Sets up the bins, bands and RMS scale for frames from fft with its
+  // current window.
+  template <typename T>
+  void configure(BasicFFT<T> *fft, double fs);
+  // Lays out nFrames rows of values. They live in an arena of their own,
+  // recycled here, so choosing other features again and again leaves the
+  // memory flat.
+  void begin(int nFrames) {
+    m_arena.reset();
+    m_values.place(m_arena, nFrames, m_nColumns);
+  }
+  // X holds the nFFT / 2 bins of a frame. pow and prevMag are nFFT / 2
+  // doubles of per-thread scratch; prevMag holds the magnitudes of the
+  // previous frame when hasPrev is set and receives those of this one.
+  template <typename T>
+  void compute(float *row, const complex<T> *X, double *pow, double *prevMag,
+               bool hasPrev);
+  template <typename T>
+  void frame(int i, const complex<T> *X, double *pow, double *prevMag,
+             bool hasPrev) {
+    compute(m_values[i], X, pow, prevMag, hasPrev);
+  }
+  template <typename S>
+  void fixFlux(int i, const complex<S> *prev, const complex<S> *cur);
+  // NaN in every row, for frames that are not computed yet.
+  void invalidate() { m_values.fill(NAN); }
+  void clear() { m_values.clear(); }
+  int nFrames() { return m_values.nRows(); }
+  // nFrames() rows of nColumns() values; null before the first analysis.
+  float **values() { return m_values.rows(); }
+  double fs() { return m_fs; }
+
+ private:
+  void updateColumns();
+  Feature columnFeature(int c);
+  bool m_enabled[NumFeature];
+  vector<double> m_bandEdges;
+  int m_column[NumFeature];
+  int m_nColumns = 0;
+  int m_nBins = 0;
+  double m_fs = 0.0;
+  double m_binHz = 0.0;
+  double m_rmsScale = 0.0;
+  static constexpr double rolloffFraction = 0.85;
+  vector<int> m_bandBins;
+  Arena m_arena;
+  Matrix<float> m_values;
+};
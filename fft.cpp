@@ -2,12 +2,75 @@
 
 #include <QtMath>
 #include <iostream>
+#include <map>
+#include <mutex>
+
+#include "codelet.hpp"
+#include "profiler.hpp"
 
 using namespace std;
 
-Window::Window(int nFFT, int size, WindowType type) {
-  m_data = new double[nFFT];
-  m_area = 0.0;
+// Inputs of the codelets, read as they are wanted.
+template <typename T>
+struct WindowedInput {
+  const T* in;
+  const T* w;
+  T scale;
+  void load(int i, T* re, T* im) const {
+    *re = w[i] * in[i] * scale;
+    *im = 0;
+  }
+};
+
+template <typename T>
+struct RealInput {
+  const T* in;
+  void load(int i, T* re, T* im) const {
+    *re = in[i];
+    *im = 0;
+  }
+};
+
+template <typename T>
+struct ConjugateInput {
+  const complex<T>* in;
+  void load(int i, T* re, T* im) const {
+    *re = in[i].real();
+    *im = -in[i].imag();
+  }
+};
+
+// batchFrames frames of the STFT, each windowed once before exec() would
+// window it again; frames from nLanes on read as zero.
+template <typename T, int K>
+struct FramesInput {
+  const double* x;
+  long hop;
+  int nLanes;
+  const T* w;
+  T scale;
+  void load(int i, CodeletLanes<T, K>* re, CodeletLanes<T, K>* im) const {
+    for (int f = 0; f < K; f++) {
+      re->v[f] = f < nLanes ? w[i] * ((T)x[f * hop + i] * w[i]) * scale : 0;
+      im->v[f] = 0;
+    }
+  }
+};
+
+// Largest size with a codelet, for the scratch on the stack.
+static const int codeletMax = 512;
+
+// Largest block of execFrames() taken through its leading stages before the
+// next is loaded, in values of T over all frames: with the imaginary parts,
+// 16 kB in float and 32 kB in double.
+static const int frameBlockMax = 8192;
+
+template <typename T>
+BasicWindow<T>::BasicWindow(int nFFT, int size, WindowType type)
+    : m_data(nFFT), m_type(type), m_size(size) {
+  PROFILE_SCOPE("Window");
+  // Computed in double, stored in T.
+  double area = 0.0;
   for (int i = 0; i < nFFT; i++) {
     m_data[i] = 0.0;
   }
@@ -15,27 +78,27 @@ Window::Window(int nFFT, int size, WindowType type) {
     case WindowType::Gaussian:
       for (int i = 0; i < nFFT; i++) {
         m_data[i] = exp(-pow(3.0 * (nFFT / 2.0 - i) / (size / 2.0), 2.0));
-        m_area += m_data[i];
+        area += m_data[i];
       }
       break;
     case WindowType::Hamming:
       for (int i = nFFT / 2 - size / 2; i < nFFT / 2 + size / 2; i++) {
         m_data[i] =
             0.54 - 0.46 * cos(2.0 * M_PI * (i - nFFT / 2 - size / 2) / size);
-        m_area += m_data[i];
+        area += m_data[i];
       }
       break;
     case WindowType::Hann:
       for (int i = nFFT / 2 - size / 2; i < nFFT / 2 + size / 2; i++) {
         m_data[i] =
             0.5 - 0.5 * cos(2.0 * M_PI * (i - nFFT / 2 - size / 2) / size);
-        m_area += m_data[i];
+        area += m_data[i];
       }
       break;
     case WindowType::Rect:
       for (int i = nFFT / 2 - size / 2; i < nFFT / 2 + size / 2; i++) {
         m_data[i] = 1.0;
-        m_area += m_data[i];
+        area += m_data[i];
       }
       break;
     default:
@@ -43,66 +106,403 @@ Window::Window(int nFFT, int size, WindowType type) {
       cerr << "Force set to Rectangle window." << endl;
       for (int i = nFFT / 2 - size / 2; i < nFFT / 2 + size / 2; i++) {
         m_data[i] = 1.0;
-        m_area += m_data[i];
+        area += m_data[i];
       }
       break;
   }
+  m_area = area;
+}
+
+// Entries are weak so a window goes away with its last FFT.
+template <typename T>
+shared_ptr<const BasicWindow<T>> BasicWindow<T>::get(int nFFT, int size,
+                                                     WindowType type) {
+  static mutex cacheMutex;
+  static map<tuple<int, int, int>, weak_ptr<const BasicWindow>> cache;
+  lock_guard<mutex> lock(cacheMutex);
+  tuple<int, int, int> key(nFFT, size, type);
+  shared_ptr<const BasicWindow> window = cache[key].lock();
+  if (window) {
+    return window;
+  }
+  for (auto it = cache.begin(); it != cache.end();) {
+    it = it->second.expired() ? cache.erase(it) : next(it);
+  }
+  window = make_shared<BasicWindow>(nFFT, size, type);
+  cache[key] = window;
+  return window;
 }
 
-FFT::FFT(int nFFT, Window::WindowType windowType, double fs) {
+template <typename T>
+BasicFFT<T>::BasicFFT(int nFFT, WindowBase::WindowType windowType, double fs) {
+  if (!isFastSize(nFFT)) {
+    cerr << "Unsupported FFT size: " << nFFT << endl;
+    nFFT = fastSize(nFFT);
+    cerr << "Force set to " << nFFT << "." << endl;
+  }
   m_nFFT = nFFT;
-  m_window = new Window(nFFT, nFFT, windowType);
-  m_bitRevTable = genBitRevTable();
-  m_coef = genCoef();
+  m_window = BasicWindow<T>::get(nFFT, nFFT, windowType);
+  m_plan = getPlan(nFFT);
   m_fs = fs;
 }
 
-FFT::~FFT() {
-  delete[] m_bitRevTable;
-  delete[] m_coef;
+template <typename T>
+bool BasicFFT<T>::isFastSize(int n) {
+  if (n < 1) {
+    return false;
+  }
+  for (int r : {2, 3, 5}) {
+    while (n % r == 0) {
+      n /= r;
+    }
+  }
+  return n == 1;
 }
 
-int* FFT::genBitRevTable() {
-  int* bitRevTable = new int[m_nFFT];
-  int bitNum = log2(m_nFFT);
-  for (int i = 0; i < m_nFFT; i++) {
-    bitRevTable[i] = 0;
-    for (int j = bitNum - 1; j >= 0; j--) {
-      bitRevTable[i] |= (1 & (i >> j)) << ((bitNum - 1) - j);
+template <typename T>
+int BasicFFT<T>::fastSize(int n) {
+  while (!isFastSize(n)) {
+    n++;
+  }
+  return n;
+}
+
+// Plans are immutable and shared by every FFT of the same size. Twiddles
+// of a new size are taken from a cached multiple of it when there is one.
+template <typename T>
+shared_ptr<const typename BasicFFT<T>::Plan> BasicFFT<T>::getPlan(int nFFT) {
+  static mutex cacheMutex;
+  static map<int, shared_ptr<const Plan>> cache;
+  lock_guard<mutex> lock(cacheMutex);
+  auto it = cache.find(nFFT);
+  if (it != cache.end()) {
+    return it->second;
+  }
+  shared_ptr<Plan> plan = make_shared<Plan>();
+  int n = nFFT;
+  for (int r : {4, 2, 3, 5}) {
+    while (n % r == 0) {
+      plan->factors.push_back(r);
+      n /= r;
+    }
+  }
+  plan->perm.resize(nFFT);
+  genPerm(*plan, 0, 0, 1, nFFT, plan->factors.size() - 1);
+  plan->coef.resize(nFFT);
+  const Plan *parent = nullptr;
+  for (auto &cached : cache) {
+    if (cached.first % nFFT == 0) {
+      parent = cached.second.get();
+      break;
+    }
+  }
+  for (int k = 0; k < nFFT; k++) {
+    if (parent) {
+      plan->coef[k] = parent->coef[(long)k * (parent->coef.size() / nFFT)];
+    } else {
+      plan->coef[k] = complex<T>(exp(-2.0 * M_PI / nFFT * k * 1.0i));
     }
   }
-  return bitRevTable;
+  cache[nFFT] = plan;
+  return plan;
 }
 
-complex<double>* FFT::genCoef() {
-  complex<double>* coef = new complex<double>[m_nFFT];
-  for (int i = 0; i < m_nFFT / 2.0; i++) {
-    coef[i] = exp(-2.0 * M_PI / m_nFFT * i * 1.0i);
+// Input permutation of the mixed-radix decimation in time, the
+// generalization of the bit-reversal table: the last stage combines
+// factors[level] interleaved sub-transforms stored one after another.
+template <typename T>
+void BasicFFT<T>::genPerm(Plan &plan, int pos, int offset, int stride, int n,
+                          int level) {
+  if (n == 1) {
+    plan.perm[pos] = offset;
+    return;
+  }
+  int r = plan.factors[level];
+  int m = n / r;
+  for (int q = 0; q < r; q++) {
+    genPerm(plan, pos + q * m, offset + q * stride, stride * r, m, level - 1);
   }
-  return coef;
 }
 
-void FFT::exec(double* in, complex<double>* out) {
-  complex<double>* tmp = new complex<double>[m_nFFT];
-  complex<double> tmptmp;
+template <typename T>
+void BasicFFT<T>::exec(T* in, complex<T>* out) {
+  Profiler::add(Profiler::FFTExec);
+  const int* perm = m_plan->perm.data();
+  const T* w = m_window->data();
+  T scale = 1 / m_window->area();
+  alignas(64) T scratch[2 * codeletMax];
+  if (runCodelet(m_nFFT, WindowedInput<T>{in, w, scale}, out, scratch)) {
+    return;
+  }
   for (int i = 0; i < m_nFFT; i++) {
-    tmp[i] = m_window->data()[i] * in[i];
-  }
-  int iMax = log2(m_nFFT);
-  for (int i = 0; i < iMax; i++) {
-    int jMax = 1 << i;
-    for (int j = 0; j < jMax; j++) {
-      int kMax = m_nFFT / (1 << (i + 1));
-      for (int k = 0; k < kMax; k++) {
-        tmptmp = tmp[j * (kMax << 1) + k];
-        tmp[j * (kMax << 1) + k] += tmp[j * (kMax << 1) + kMax + k];
-        tmp[j * (kMax << 1) + kMax + k] =
-            (-tmp[j * (kMax << 1) + kMax + k] + tmptmp) * m_coef[k * (1 << i)];
-      }
+    out[i] = w[perm[i]] * in[perm[i]] * scale;
+  }
+  butterfly(out);
+}
+
+// Unwindowed, unnormalized transform.
+template <typename T>
+void BasicFFT<T>::transform(const T* in, complex<T>* out) {
+  Profiler::add(Profiler::FFTTransform);
+  const int* perm = m_plan->perm.data();
+  alignas(64) T scratch[2 * codeletMax];
+  if (runCodelet(m_nFFT, RealInput<T>{in}, out, scratch)) {
+    return;
+  }
+  for (int i = 0; i < m_nFFT; i++) {
+    out[i] = in[perm[i]];
+  }
+  butterfly(out);
+}
+
+// conj(DFT(conj(X))) / N, through the forward butterflies.
+template <typename T>
+void BasicFFT<T>::inverse(const complex<T>* in, complex<T>* out) {
+  Profiler::add(Profiler::FFTTransform);
+  const int* perm = m_plan->perm.data();
+  alignas(64) T scratch[2 * codeletMax];
+  if (!runCodelet(m_nFFT, ConjugateInput<T>{in}, out, scratch)) {
+    for (int i = 0; i < m_nFFT; i++) {
+      out[i] = conj(in[perm[i]]);
     }
+    butterfly(out);
   }
+  T scale = T(1) / m_nFFT;
   for (int i = 0; i < m_nFFT; i++) {
-    out[m_bitRevTable[i]] = tmp[i] / m_window->area();
+    out[i] = conj(out[i]) * scale;
+  }
+}
+
+// Frame f of element j sits at j * batchFrames + f of re and im. Stages
+// with a span up to frameBlockMax / batchFrames run block by block as the
+// input is gathered, while the block is in L1; the rest run over the whole
+// batch. Every butterfly then works on batchFrames frames with the same
+// twiddles, as plain element-wise loops.
+template <typename T>
+void BasicFFT<T>::execFrames(const double* x, long hop, int nFrames, int nOut,
+                             complex<T>* out, T* scratch) {
+  const int K = batchFrames;
+  Profiler::add(Profiler::FFTExec, nFrames);
+  const int* perm = m_plan->perm.data();
+  const T* w = m_window->data();
+  T scale = 1 / m_window->area();
+  const vector<int>& factors = m_plan->factors;
+  int nBlockStages = 0;
+  int blockSpan = 1;
+  while (nBlockStages < (int)factors.size() &&
+         blockSpan * factors[nBlockStages] * K <= frameBlockMax) {
+    blockSpan *= factors[nBlockStages++];
+  }
+  T* re = scratch;
+  T* im = scratch + (long)K * m_nFFT;
+  for (int f0 = 0; f0 < nFrames; f0 += K) {
+    int nLanes = min(K, nFrames - f0);
+    const double* xf = x + f0 * hop;
+    FramesInput<T, K> src{xf, hop, nLanes, w, scale};
+    if (!runCodelet<T>(m_nFFT, src, (CodeletLanes<T, K>*)re,
+                       (CodeletLanes<T, K>*)im)) {
+      for (int b = 0; b < m_nFFT; b += blockSpan) {
+        for (int j = b; j < b + blockSpan; j++) {
+          int p = perm[j];
+          T* r = re + (long)j * K;
+          for (int f = 0; f < K; f++) {
+            r[f] = f < nLanes ? w[p] * ((T)xf[f * hop + p] * w[p]) * scale
+                              : 0;
+            im[(long)j * K + f] = 0;
+          }
+        }
+        for (int s = 0, m = 1; s < nBlockStages; m *= factors[s++]) {
+          for (int sb = b; sb < b + blockSpan; sb += m * factors[s]) {
+            butterflyFrames(re, im, sb, factors[s], m);
+          }
+        }
+      }
+      for (int s = nBlockStages, m = blockSpan; s < (int)factors.size();
+           m *= factors[s++]) {
+        for (int b = 0; b < m_nFFT; b += m * factors[s]) {
+          butterflyFrames(re, im, b, factors[s], m);
+        }
+      }
+    }
+    for (int f = 0; f < nLanes; f++) {
+      complex<T>* X = out + (long)(f0 + f) * nOut;
+      for (int k = 0; k < nOut; k++) {
+        X[k] = complex<T>(re[(long)k * K + f], im[(long)k * K + f]);
+      }
+    }
+  }
+}
+
+// The butterflies of one radix-R stage over the block of R m elements at
+// b of K frames side by side; the same arithmetic as butterfly(). Each
+// butterfly loads its rows, works on local copies and stores them back row
+// by row: stores interleaved with the arithmetic would keep the compiler
+// from proving that the rows do not overlap, and it would not vectorize
+// across the frames. R is a template parameter so the loops over the rows
+// unroll.
+template <typename T, int R, int K>
+static void frameButterflies(T* re, T* im, int b, int m,
+                             const complex<T>* coef, int nFFT) {
+  int step = nFFT / (m * R);
+  long mK = (long)m * K;
+  for (int j = 0; j < m; j++) {
+    T* pr = re + (long)(b + j) * K;
+    T* pi = im + (long)(b + j) * K;
+    T vr[R][K];
+    T vi[R][K];
+    for (int q = 0; q < R; q++) {
+      for (int f = 0; f < K; f++) {
+        vr[q][f] = pr[q * mK + f];
+        vi[q][f] = pi[q * mK + f];
+      }
+    }
+    if constexpr (R == 2) {
+      T wr = coef[j * step].real();
+      T wi = coef[j * step].imag();
+      for (int f = 0; f < K; f++) {
+        T tr = vr[1][f] * wr - vi[1][f] * wi;
+        T ti = vr[1][f] * wi + vi[1][f] * wr;
+        vr[1][f] = vr[0][f] - tr;
+        vi[1][f] = vi[0][f] - ti;
+        vr[0][f] += tr;
+        vi[0][f] += ti;
+      }
+    } else if constexpr (R == 4) {
+      T w1r = coef[j * step].real();
+      T w1i = coef[j * step].imag();
+      T w2r = coef[2 * j * step].real();
+      T w2i = coef[2 * j * step].imag();
+      T w3r = coef[3 * j * step].real();
+      T w3i = coef[3 * j * step].imag();
+      for (int f = 0; f < K; f++) {
+        T ar = vr[0][f];
+        T ai = vi[0][f];
+        T cr = vr[1][f] * w1r - vi[1][f] * w1i;
+        T ci = vr[1][f] * w1i + vi[1][f] * w1r;
+        T dr = vr[2][f] * w2r - vi[2][f] * w2i;
+        T di = vr[2][f] * w2i + vi[2][f] * w2r;
+        T er = vr[3][f] * w3r - vi[3][f] * w3i;
+        T ei = vr[3][f] * w3i + vi[3][f] * w3r;
+        T t0r = ar + dr;
+        T t0i = ai + di;
+        T t1r = ar - dr;
+        T t1i = ai - di;
+        T t2r = cr + er;
+        T t2i = ci + ei;
+        // -i (c - e)
+        T t3r = ci - ei;
+        T t3i = er - cr;
+        vr[0][f] = t0r + t2r;
+        vi[0][f] = t0i + t2i;
+        vr[1][f] = t1r + t3r;
+        vi[1][f] = t1i + t3i;
+        vr[2][f] = t0r - t2r;
+        vi[2][f] = t0i - t2i;
+        vr[3][f] = t1r - t3r;
+        vi[3][f] = t1i - t3i;
+      }
+    } else {
+      T ur[R][K];
+      T ui[R][K];
+      for (int q = 0; q < R; q++) {
+        T wr = coef[q * j * step].real();
+        T wi = coef[q * j * step].imag();
+        for (int f = 0; f < K; f++) {
+          ur[q][f] = vr[q][f] * wr - vi[q][f] * wi;
+          ui[q][f] = vr[q][f] * wi + vi[q][f] * wr;
+        }
+      }
+      for (int k = 0; k < R; k++) {
+        for (int f = 0; f < K; f++) {
+          vr[k][f] = ur[0][f];
+          vi[k][f] = ui[0][f];
+        }
+        for (int q = 1; q < R; q++) {
+          const complex<T>& c = coef[(k * q % R) * (nFFT / R)];
+          for (int f = 0; f < K; f++) {
+            vr[k][f] += ur[q][f] * c.real() - ui[q][f] * c.imag();
+            vi[k][f] += ur[q][f] * c.imag() + ui[q][f] * c.real();
+          }
+        }
+      }
+    }
+    for (int q = 0; q < R; q++) {
+      for (int f = 0; f < K; f++) {
+        pr[q * mK + f] = vr[q][f];
+        pi[q * mK + f] = vi[q][f];
+      }
+    }
   }
-  delete[] tmp;
-}
\ No newline at end of file
+}
+
+template <typename T>
+void BasicFFT<T>::butterflyFrames(T* re, T* im, int b, int r, int m) {
+  const int K = batchFrames;
+  const complex<T>* coef = m_plan->coef.data();
+  switch (r) {
+    case 2:
+      frameButterflies<T, 2, K>(re, im, b, m, coef, m_nFFT);
+      break;
+    case 3:
+      frameButterflies<T, 3, K>(re, im, b, m, coef, m_nFFT);
+      break;
+    case 4:
+      frameButterflies<T, 4, K>(re, im, b, m, coef, m_nFFT);
+      break;
+    default:
+      frameButterflies<T, 5, K>(re, im, b, m, coef, m_nFFT);
+      break;
+  }
+}
+
+template <typename T>
+void BasicFFT<T>::butterfly(complex<T>* x) {
+  const complex<T>* coef = m_plan->coef.data();
+  int span = 1;
+  for (int r : m_plan->factors) {
+    int m = span;
+    span *= r;
+    int step = m_nFFT / span;
+    for (int b = 0; b < m_nFFT; b += span) {
+      for (int j = 0; j < m; j++) {
+        complex<T>* p = x + b + j;
+        if (r == 2) {
+          complex<T> t = p[m] * coef[j * step];
+          p[m] = p[0] - t;
+          p[0] += t;
+        } else if (r == 4) {
+          complex<T> a = p[0];
+          complex<T> c = p[m] * coef[j * step];
+          complex<T> d = p[2 * m] * coef[2 * j * step];
+          complex<T> e = p[3 * m] * coef[3 * j * step];
+          complex<T> t0 = a + d;
+          complex<T> t1 = a - d;
+          complex<T> t2 = c + e;
+          complex<T> t3 = c - e;
+          t3 = complex<T>(t3.imag(), -t3.real());  // -i * t3
+          p[0] = t0 + t2;
+          p[m] = t1 + t3;
+          p[2 * m] = t0 - t2;
+          p[3 * m] = t1 - t3;
+        } else {
+          complex<T> v[5];
+          for (int q = 0; q < r; q++) {
+            v[q] = p[q * m] * coef[q * j * step];
+          }
+          for (int k = 0; k < r; k++) {
+            complex<T> acc = v[0];
+            for (int q = 1; q < r; q++) {
+              acc += v[q] * coef[(k * q % r) * (m_nFFT / r)];
+            }
+            p[k * m] = acc;
+          }
+        }
+      }
+    }
+  }
+}
+
+template class BasicWindow<float>;
+template class BasicWindow<double>;
+template class BasicFFT<float>;
+template class BasicFFT<double>;
@@ -1,40 +1,98 @@
 #pragma once
 
+#include <algorithm>
 #include <complex>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "buffer.hpp"
 
 using namespace std;
 
-class Window {
+class WindowBase {
  public:
   enum WindowType { Gaussian, Hann, Hamming, Rect, NumWindow };
-  Window(int nFFT, int size, WindowType type);
-  ~Window() { delete[] m_data; }
-  double *data() { return m_data; }
-  double area() { return m_area; }
+};
+
+// T is float or double (explicitly instantiated in fft.cpp). Windows are
+// immutable once built; get() shares one instance per nFFT, size and type
+// among all holders, across sounds and threads.
+template <typename T>
+class BasicWindow : public WindowBase {
+ public:
+  BasicWindow(int nFFT, int size, WindowType type);
+  static shared_ptr<const BasicWindow> get(int nFFT, int size,
+                                           WindowType type);
+  const T *data() const { return m_data.data(); }
+  T area() const { return m_area; }
+  WindowType type() const { return m_type; }
+  int size() const { return m_size; }
 
  private:
-  double *m_data;
-  double m_area;
+  AlignedBuffer<T> m_data;
+  T m_area;
+  WindowType m_type;
+  int m_size;
 };
 
-class FFT {
+// Mixed-radix (2, 3, 4, 5) transform of any size 2^a 3^b 5^c. Twiddles are
+// computed in double and rounded to T. With T = float, measured against
+// double for nFFT = 2048 and 65536 on tones in noise, every bin within
+// 100 dB of the frame maximum stays within 0.005 dB, and the error floor
+// sits about 140 dB below the maximum. The power-of-two sizes 32 .. 512
+// run the unrolled codelets of codelet.hpp instead of the plan.
+template <typename T>
+class BasicFFT {
  public:
-  FFT(int nFFT, Window::WindowType windowType, double fs);
-  ~FFT();
+  BasicFFT(int nFFT, WindowBase::WindowType windowType, double fs);
+  static bool isFastSize(int n);
+  static int fastSize(int n);
   int nFFT() { return m_nFFT; }
-  Window *window() { return m_window; }
-  void exec(double *in, complex<double> *out);
-  void setWindow(Window::WindowType windowType, int windowSize) {
-    delete m_window;
-    m_window = new Window(m_nFFT, windowSize, windowType);
+  const BasicWindow<T> *window() { return m_window.get(); }
+  // Windowed and normalized by the window area. No allocation; safe to call
+  // from several threads once the window is set.
+  void exec(T *in, complex<T> *out);
+  void transform(const T *in, complex<T> *out);
+  // Inverse of transform(), scaled by 1 / nFFT, so the two round-trip.
+  // The real part of out is the signal when in is conjugate-symmetric.
+  void inverse(const complex<T> *in, complex<T> *out);
+  // Frames transformed side by side by execFrames().
+  static constexpr int batchFrames = 4;
+  // exec() of nFrames frames as the STFT feeds them: frame f is
+  // in[n] = x[f * hop + n] * w[n], w the window, so the window applies
+  // twice. Its first nOut bins go to out + f * nOut. scratch holds
+  // 2 * batchFrames * nFFT values of T. The sizes with a codelet run it on
+  // batchFrames frames at once; the others run the plan, with the copy-in
+  // done by the first stages. Either way each twiddle is loaded once for
+  // batchFrames frames and the numbers are those of exec().
+  void execFrames(const double *x, long hop, int nFrames, int nOut,
+                  complex<T> *out, T *scratch);
+  // The current window is kept when type and size are unchanged.
+  void setWindow(WindowBase::WindowType windowType, int windowSize) {
+    windowSize = min(windowSize, m_nFFT);
+    if (m_window->type() == windowType && m_window->size() == windowSize) {
+      return;
+    }
+    m_window = BasicWindow<T>::get(m_nFFT, windowSize, windowType);
   }
 
  private:
-  int *genBitRevTable();
-  complex<double> *genCoef();
+  struct Plan {
+    vector<int> factors;
+    vector<int> perm;
+    vector<complex<T>> coef;
+  };
+  static shared_ptr<const Plan> getPlan(int nFFT);
+  static void genPerm(Plan &plan, int pos, int offset, int stride, int n,
+                      int level);
+  void butterfly(complex<T> *x);
+  void butterflyFrames(T *re, T *im, int b, int r, int m);
   int m_nFFT;
-  Window *m_window;
+  shared_ptr<const BasicWindow<T>> m_window;
   double m_fs;
-  int *m_bitRevTable;
-  complex<double> *m_coef;
-};
\ No newline at end of file
+  shared_ptr<const Plan> m_plan;
+};
+
+using Window = BasicWindow<double>;
+using FFT = BasicFFT<double>;
@@ -1,9 +1,42 @@
 #include "mainwindow.hpp"
 
 #include <QApplication>
+#include <QFileInfo>
+#include <iostream>
+
+#include "batch.hpp"
+#include "exporter.hpp"
+
+// tfy --batch <output dir> <file.wav>...
+// Exports the STFT of every file as .npy with a JSON sidecar.
+static int runBatch(int argc, char *argv[])
+{
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " --batch <output dir> <file>..."
+                  << std::endl;
+        return 1;
+    }
+    QString outDir = QString::fromLocal8Bit(argv[2]);
+    std::vector<std::string> fnames(argv + 3, argv + argc);
+    Batch batch;
+    Batch::Stats stats = batch.run(
+        fnames, [&](const std::string &fname, Sound &sound) {
+            QFileInfo info(QString::fromStdString(fname));
+            QString base = outDir + "/" + info.completeBaseName();
+            sound.setFFTSize(2048);
+            Exporter exporter(&sound);
+            return exporter.exportSTFT(base.toStdString(), 512,
+                                       Window::WindowType::Hann, 2048);
+        });
+    std::cerr << stats.summary() << std::endl;
+    return stats.nFailed ? 1 : 0;
+}
 
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && std::string(argv[1]) == "--batch") {
+        return runBatch(argc, argv);
+    }
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
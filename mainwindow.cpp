@@ -1,11 +1,17 @@
 #include "mainwindow.hpp"
 
 #include <QFileDialog>
-#include <QImage>
-#include <QPixmap>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QOpenGLWidget>
+#include <algorithm>
+#include <thread>
 
+#include "exporter.hpp"
 #include "fft.hpp"
+#include "mel.hpp"
 #include "playback.hpp"
+#include "profiler.hpp"
 
 using namespace std;
 
@@ -14,6 +20,44 @@ WaveScene::WaveScene(int x, int y, int w, int h, MainWindow *parent)
   m_parent = parent;
 }
 
+void PlayheadItem::paint(QPainter *painter,
+                         const QStyleOptionGraphicsItem *option,
+                         QWidget *widget) {
+  Q_UNUSED(option);
+  Q_UNUSED(widget);
+  QPen pen(QColor(Qt::red));
+  pen.setCosmetic(true);
+  painter->setPen(pen);
+  painter->drawLine(QPointF(0.0, 0.0), QPointF(0.0, m_h));
+}
+
+void WaveScene::setCurrentStreamPosLine(double x) {
+  if (!m_currentStreamPosLine) {
+    m_currentStreamPosLine = new PlayheadItem(height());
+    m_currentStreamPosLine->setZValue(1.0);
+    addItem(m_currentStreamPosLine);
+  }
+  m_currentStreamPosLine->setPos(x, 0.0);
+}
+
+void WaveScene::setEventMarks(const QPainterPath &path) {
+  if (!m_eventMarks) {
+    QPen pen(QColor(255, 220, 0, 160));
+    pen.setCosmetic(true);
+    m_eventMarks = addPath(path, pen);
+    m_eventMarks->setZValue(0.5);
+    return;
+  }
+  m_eventMarks->setPath(path);
+}
+
+void WaveScene::mousePressEvent(QGraphicsSceneMouseEvent *e) {
+  if (!m_parent->sound() || e->button() != Qt::LeftButton) {
+    return;
+  }
+  m_parent->seek(e->scenePos().x() / width() * m_parent->sound()->duration());
+}
+
 void WaveScene::mouseMoveEvent(QGraphicsSceneMouseEvent *e) {
   if (!m_parent->sound()) {
     return;
@@ -34,9 +78,21 @@ WaveView::WaveView(int x, int y, int w, int h, MainWindow *parent)
 }
 
 void WaveView::init() {
+  // Keep the playhead and the event markers across the redraw.
+  QList<QGraphicsItem *> kept;
+  for (QGraphicsItem *item :
+       {m_scene->currentStreamPosLine(), m_scene->eventMarks()}) {
+    if (item) {
+      m_scene->removeItem(item);
+      kept.append(item);
+    }
+  }
   m_scene->clear();
   m_scene->addLine(0, m_scene->height() / 2, m_scene->width(),
                    m_scene->height() / 2, QColor(100, 100, 200));
+  for (QGraphicsItem *item : kept) {
+    m_scene->addItem(item);
+  }
 }
 
 void WaveView::drawWaveForm(Sound *sound) {
@@ -68,7 +124,11 @@ TFScene::TFScene(int x, int y, int w, int h, MainWindow *parent)
     : QGraphicsScene(x, y, w, h, parent) {
   m_parent = parent;
   setBackgroundBrush(QColor(Qt::black));
-  m_data = new unsigned char[w * h * 3];
+  m_tfMap = new TFMapItem(w, h);
+  m_tfMap->setZValue(-1.0);
+  addItem(m_tfMap);
+  m_fillTimer = new QTimer(this);
+  connect(m_fillTimer, &QTimer::timeout, this, &TFScene::fillStep);
 }
 
 TFScene::~TFScene() {
@@ -78,45 +138,82 @@ TFScene::~TFScene() {
   if (m_ticks) {
     delete m_ticks;
   }
-  delete[] m_data;
+  if (m_overlay) {
+    delete m_overlay;
+  }
+  if (m_regionItem) {
+    delete m_regionItem;
+  }
+  if (m_eventMarks) {
+    delete m_eventMarks;
+  }
+}
+
+bool TFScene::region(double *t0, double *t1, double *f0, double *f1) {
+  if (m_dragging || m_regionT0 == m_regionT1 || m_regionF0 == m_regionF1) {
+    return false;
+  }
+  *t0 = min(m_regionT0, m_regionT1);
+  *t1 = max(m_regionT0, m_regionT1);
+  *f0 = min(m_regionF0, m_regionF1);
+  *f1 = max(m_regionF0, m_regionF1);
+  return true;
+}
+
+void TFScene::clearRegion() {
+  m_dragging = false;
+  m_regionT0 = m_regionT1 = 0.0;
+  m_regionF0 = m_regionF1 = 0.0;
+  drawRegion();
+}
+
+// Shift+drag picks a region; a plain drag still pans the view, which only
+// happens when the press is left unaccepted.
+void TFScene::mousePressEvent(QGraphicsSceneMouseEvent *e) {
+  if (!m_parentSound || m_timebase || e->button() != Qt::LeftButton ||
+      !(e->modifiers() & Qt::ShiftModifier)) {
+    QGraphicsScene::mousePressEvent(e);
+    return;
+  }
+  m_dragging = true;
+  m_regionT0 = m_regionT1 =
+      e->scenePos().x() / width() * m_parentSound->duration();
+  m_regionF0 = m_regionF1 = y2hz(e->scenePos().y());
+  drawRegion();
+  e->accept();
+}
+
+void TFScene::mouseReleaseEvent(QGraphicsSceneMouseEvent *e) {
+  if (!m_dragging) {
+    QGraphicsScene::mouseReleaseEvent(e);
+    return;
+  }
+  // A Shift+click without a drag leaves an empty region, which clears it.
+  m_dragging = false;
+  drawRegion();
 }
 
 void TFScene::mouseMoveEvent(QGraphicsSceneMouseEvent *e) {
   if (!m_parentSound) {
     return;
   }
-  double fs = m_parentSound->fs();
   double duration = m_parentSound->duration();
-  double y = e->scenePos().y();
   double x = e->scenePos().x();
-  double h = height();
   double w = width();
-  double freq = (height() - y) / height() * fs / 2.0;
+  double freq = y2hz(e->scenePos().y());
   double time = x / w * duration;
-  double erbHi = hz2erb(fs / 2.0);
-  double barkHi = hz2bark(fs / 2.0);
-  double melHi = hz2mel(fs / 2.0);
-  switch (m_freqScale) {
-    case Linear:
-      freq = (h - y) / h * fs / 2.0;
-      break;
-    case Log:
-      freq = (pow(h, (h - y) / h) - 1.0) / h * fs / 2.0;
-      break;
-    case ERB:
-      freq = erb2hz((h - y) / h * erbHi);
-      break;
-    case Bark:
-      freq = bark2hz((h - y) / h * barkHi);
-      break;
-    case Mel:
-      freq = mel2hz((h - y) / h * melHi);
-      break;
-    default:
-      break;
+  if (m_dragging) {
+    m_regionT1 = min(max(time, 0.0), duration);
+    m_regionF1 = min(max(freq, 0.0), m_parentSound->fs() / 2.0);
+    drawRegion();
   }
   m_parent->freqLabel()->setText(QString::number(freq));
   m_parent->timeLabel()->setText(QString::number(time));
+  int nFrames = m_parentSound->nFrames();
+  if (nFrames && !m_timebase) {
+    m_parent->sliceView()->setFrame(
+        min(max((int)(x / w * nFrames), 0), nFrames - 1));
+  }
 }
 
 void TFScene::drawFreqTicks() {
@@ -126,14 +223,14 @@ void TFScene::drawFreqTicks() {
   }
   m_ticks = new QGraphicsItemGroup();
   int fs = m_parentSound->fs();
-  int nFFT = m_parentSound->fft()->nFFT();
+  int nBins = m_parentSound->nBins();
   int h = height();
   double fCur = 1.0;
   double fStep;
   double yPos;
-  static double erbHi = hz2erb(fs / 2.0);
-  static double cbrHi = hz2bark(fs / 2.0);
-  static double mHi = hz2mel(fs / 2.0);
+  double erbHi = hz2erb(fs / 2.0);
+  double cbrHi = hz2bark(fs / 2.0);
+  double mHi = hz2mel(fs / 2.0);
   switch (m_freqScale) {
     case Linear:
       for (double f = 0; f < fs / 2.0; f += 100.0) {
@@ -158,8 +255,8 @@ void TFScene::drawFreqTicks() {
           if (f > fs / 2.0) {
             break;
           }
-          double kLinear = f / fs * nFFT;
-          double kLog = log(kLinear + 1) / log(nFFT / 2.0);
+          double kLinear = f / (fs / 2.0) * nBins;
+          double kLog = log(kLinear + 1) / log(nBins);
           yPos = h - kLog * h;
           if (j == 1) {
             m_ticks->addToGroup(addLine(0, yPos, 10.0, yPos, QColor(Qt::gray)));
@@ -239,98 +336,447 @@ void TFScene::drawFreqTicks() {
 }
 
 TFView::TFView(QWidget *parent) : QGraphicsView(parent) {
+  setViewport(new QOpenGLWidget());
+  setViewportUpdateMode(QGraphicsView::FullViewportUpdate);
+  setTransformationAnchor(QGraphicsView::AnchorUnderMouse);
+  setDragMode(QGraphicsView::ScrollHandDrag);
   setMouseTracking(true);
+  // Scene x = 0 is the start of the file in both views of a pair, also when
+  // one of them is narrower than the viewport.
+  setAlignment(Qt::AlignLeft | Qt::AlignTop);
 }
 
 TFView::~TFView() {}
 
+void TFView::scrollContentsBy(int dx, int dy) {
+  QGraphicsView::scrollContentsBy(dx, dy);
+  viewChanged();
+}
+
+void TFView::resizeEvent(QResizeEvent *e) {
+  QGraphicsView::resizeEvent(e);
+  viewChanged();
+}
+
+void TFView::viewChanged() {
+  if (scene()) {
+    static_cast<TFScene *>(scene())->viewChanged();
+  }
+}
+
+void TFView::wheelEvent(QWheelEvent *e) {
+  if (!(e->modifiers() & Qt::ControlModifier)) {
+    QGraphicsView::wheelEvent(e);
+    return;
+  }
+  double factor = pow(1.2, e->angleDelta().y() / 120.0);
+  if (e->modifiers() & Qt::ShiftModifier) {
+    scale(1.0, factor);
+  } else {
+    scale(factor, 1.0);
+  }
+  // A scene beside the main one is fully zoomed out when the main one is.
+  TFScene *tfScene = static_cast<TFScene *>(scene());
+  double minScale = 1.0;
+  if (tfScene->timebase() && tfScene->parentSound()) {
+    minScale = tfScene->parentSound()->duration() /
+               tfScene->timebase()->duration();
+  }
+  if (transform().m11() < minScale || transform().m22() < 1.0) {
+    setTransform(QTransform::fromScale(minScale, 1.0));
+  }
+  viewChanged();
+  syncPartner();
+}
+
+void TFView::zoomTo(double x0, double x1) {
+  double sx = max(viewport()->width() / max(x1 - x0, 1e-9), 1.0);
+  double y = mapToScene(viewport()->rect().center()).y();
+  setTransform(QTransform::fromScale(sx, transform().m22()));
+  centerOn((x0 + x1) / 2.0, y);
+  viewChanged();
+  syncPartner();
+}
+
+// Each scene spans its own file, so the partner is scaled by the ratio of
+// the durations to show as many pixels per second; the scroll bar values
+// then match in time as well. The partner only follows: a shorter file
+// clamps its scroll range, which must not pull this view back.
+void TFView::syncPartner() {
+  if (!m_partner || !m_partner->isVisible() || m_following) {
+    return;
+  }
+  Sound *sound = static_cast<TFScene *>(scene())->parentSound();
+  Sound *other = static_cast<TFScene *>(m_partner->scene())->parentSound();
+  if (!sound || !other) {
+    return;
+  }
+  m_partner->m_following = true;
+  m_partner->setTransform(QTransform::fromScale(
+      transform().m11() * other->duration() / sound->duration(),
+      transform().m22()));
+  m_partner->horizontalScrollBar()->setValue(horizontalScrollBar()->value());
+  m_partner->verticalScrollBar()->setValue(verticalScrollBar()->value());
+  m_partner->m_following = false;
+  m_partner->viewChanged();
+}
+
 void TFScene::drawTFMap(Window::WindowType windowType, int windowSize) {
   int w = width();
-  int h = height();
-  int hopSize = m_parentSound->nSamples() / w;
+  int hopSize = (m_timebase ? m_timebase : m_parentSound)->nSamples() / w;
   if (m_flagModified) {
-    m_parentSound->stft(hopSize, windowType, windowSize);
-    m_flagModified = false;
-  }
-  complex<double> **spec = m_parentSound->spec();
-  double specMax = m_parentSound->specMax();
-  double specMin = m_parentSound->specMin();
-  double upper_dB, lower_dB;
-  upper_dB = 20.0 * log10(specMax);
-  // lower_dB = 20.0 * log10(specMin);
-  lower_dB = -120.0;
-  for (int x = 0; x < w; x++) {
-    for (int y = 0; y < h; y++) {
-      double2rgb((20.0 * log10(abs(spec[x][m_scaledIdx[y]])) - lower_dB) /
-                     (upper_dB - lower_dB),
-                 m_data + ((h - 1 - y) * w + x) * 3,       // R
-                 m_data + ((h - 1 - y) * w + x) * 3 + 1,   // G
-                 m_data + ((h - 1 - y) * w + x) * 3 + 2);  // B
+    int nFFT = m_nFFT ? m_nFFT : FFT::fastSize(windowSize * m_zeroPadding);
+    // The reference gets the same settings and hop, so frame i of both is
+    // the same instant and both transforms share one cached plan.
+    for (Sound *sound : {m_parentSound, m_reference}) {
+      if (!sound) {
+        continue;
+      }
+      sound->setFFTSize(nFFT);
+      sound->setPrecision(m_precision);
+      // The STFT is computed on demand, for the frames around the view;
+      // the other methods need every frame at once.
+      if (m_method == Sound::STFT) {
+        sound->prepareSTFT(hopSize, windowType, windowSize);
+      } else {
+        sound->analyze(m_method, hopSize, windowType, windowSize);
+      }
+    }
+    resetMagnitude();
+    if (!nPending()) {
+      updateMagnitude(0, m_parentSound->nFrames());
     }
+    m_parent->sliceView()->refresh();
+    m_flagModified = false;
+    m_fillTimer->stop();
+    fillStep();
   }
-  QImage img(m_data, w, h, QImage::Format_RGB888);
-  QPixmap pixmap = QPixmap::fromImage(img);
-  addPixmap(pixmap);
   drawFreqTicks();
+  drawOverlay();
 }
 
-void TFScene::setFreqScale(FreqScale type) {
+void TFScene::viewChanged() {
+  if (m_parentSound && nPending() && !m_fillTimer->isActive()) {
+    m_fillTimer->start(0);
+  }
+}
+
+// Frames past the end of a shorter reference count as ready.
+bool TFScene::frameReady(int i) {
+  return m_parentSound->frameReady(i) &&
+         (!m_reference || i >= m_reference->nFrames() ||
+          m_reference->frameReady(i));
+}
+
+int TFScene::nPending() {
+  return m_parentSound->nPending() +
+         (m_reference ? m_reference->nPending() : 0);
+}
+
+// Frames under the view, widened by half a view on each side so scrolling
+// finds them ready, and the frame at the centre.
+void TFScene::visibleFrames(int *i0, int *i1, int *center) {
+  int nFrames = m_parentSound->nFrames();
+  QRectF r = sceneRect();
+  if (!views().isEmpty()) {
+    QGraphicsView *view = views().first();
+    r = view->mapToScene(view->viewport()->rect()).boundingRect();
+  }
+  double margin = r.width() / 2.0;
+  *i0 = max((int)floor((r.left() - margin) / width() * nFrames), 0);
+  *i1 = min((int)ceil((r.right() + margin) / width() * nFrames), nFrames);
+  *center = min(max((int)(r.center().x() / width() * nFrames), *i0),
+                max(*i1 - 1, *i0));
+}
+
+// Computes missing frames around the view, nearest to its centre first,
+// for up to fillBudgetMs, then returns to the event loop. The timer keeps
+// calling it until everything around the view is there; frames are
+// computed once, so scrolling back is free.
+void TFScene::fillStep() {
+  static const int fillBudgetMs = 10;
+  static const int fillChunk = 32;
   if (!m_parentSound) {
+    m_fillTimer->stop();
     return;
   }
-  int nFFT = m_parentSound->fft()->nFFT();
-  int fs = m_parentSound->fs();
-  m_freqScale = type;
-  switch (type) {
-    case FreqScale::Linear:
-      for (int k = 0; k < nFFT / 2; k++) {
-        m_scaledIdx[k] = k;
+  int i0;
+  int i1;
+  int center;
+  visibleFrames(&i0, &i1, &center);
+  QElapsedTimer clock;
+  clock.start();
+  int changedBegin = i1;
+  int changedEnd = i0;
+  bool done = false;
+  while (clock.elapsed() < fillBudgetMs) {
+    int next = -1;
+    for (int d = 0; center - d >= i0 || center + d < i1; d++) {
+      if (center + d < i1 && !frameReady(center + d)) {
+        next = center + d;
+        break;
       }
-      break;
-    case FreqScale::Log:
-      for (int k = 0; k < nFFT / 2; k++) {
-        m_scaledIdx[k] = (int)(pow(nFFT / 2.0, (double)k / (nFFT / 2.0)) - 1.0);
+      if (center - d >= i0 && !frameReady(center - d)) {
+        next = center - d;
+        break;
       }
+    }
+    if (next < 0) {
+      done = true;
       break;
-    case FreqScale::ERB:
-      for (int k = 0; k < nFFT / 2; k++) {
-        m_scaledIdx[k] =
-            (int)(erb2hz((double)k / (nFFT / 2.0) * (hz2erb(22050.0))) / fs *
-                  nFFT);
+    }
+    int begin = max(next - fillChunk / 2, i0);
+    int end = min(begin + fillChunk, i1);
+    if (m_reference) {
+      // Each sound has its own scratch and spectrum, so the two run at once.
+      thread reference([&] { m_reference->computeFrames(begin, end); });
+      m_parentSound->computeFrames(begin, end);
+      reference.join();
+    } else {
+      m_parentSound->computeFrames(begin, end);
+    }
+    updateMagnitude(begin, end);
+    changedBegin = min(changedBegin, begin);
+    changedEnd = max(changedEnd, end);
+  }
+  bool changed = changedBegin < changedEnd;
+  if (changed) {
+    m_tfMap->magnitudeChanged(changedBegin, changedEnd);
+    m_parent->sliceView()->refresh();
+  }
+  if (done) {
+    m_fillTimer->stop();
+    if (changed) {
+      // The overlay spans every frame, so it is rebuilt once per fill.
+      drawOverlay();
+      m_parent->updateAutoRange();
+    }
+  } else if (!m_fillTimer->isActive()) {
+    m_fillTimer->start(0);
+  }
+}
+
+void TFScene::setCurrentStreamPosLine(double x) {
+  if (!m_currentStreamPosLine) {
+    m_currentStreamPosLine = new PlayheadItem(height());
+    m_currentStreamPosLine->setZValue(2.0);
+    addItem(m_currentStreamPosLine);
+  }
+  m_currentStreamPosLine->setPos(x, 0.0);
+}
+
+void TFScene::setDynamicRange(double lower_dB, double upper_dB, double gamma) {
+  m_tfMap->setRange(lower_dB, upper_dB);
+  m_tfMap->setGamma(gamma);
+}
+
+// Frames that are not computed yet stay below any floor.
+void TFScene::resetMagnitude() {
+  int nFrames = m_parentSound->nFrames();
+  int nBins = m_parentSound->nBins();
+  m_tfMap->setBinAxis(m_parentSound->fMin(), m_parentSound->binsPerOctave());
+  float *dB = m_tfMap->resizeMagnitude(nFrames, nBins);
+  fill(dB, dB + (size_t)nFrames * nBins, -HUGE_VALF);
+}
+
+static void frame_dB(Sound *sound, int i, float *dB) {
+  float lo;
+  float hi;
+  if (sound->specF()) {
+    power2dB(sound->specF()[i], sound->nBins(), dB, &lo, &hi);
+  } else {
+    power2dB(sound->spec()[i], sound->nBins(), dB, &lo, &hi);
+  }
+}
+
+// Frames begin .. end - 1, which must be computed. Against a reference the
+// map holds the difference, positive where the parent sound is louder;
+// frames past the end of the reference stay below any floor.
+void TFScene::updateMagnitude(int begin, int end) {
+  PROFILE_SCOPE("dB conversion");
+  int nFrames = m_parentSound->nFrames();
+  int nBins = m_parentSound->nBins();
+  float *dB = m_tfMap->magnitude();
+  // Frames are converted a block at a time along the bins, then written
+  // to the bin-major map one cache line per bin.
+  const int block = 16;
+  m_dBBlock.resize((size_t)block * nBins);
+  int nRefFrames = 0;
+  if (m_reference && m_reference->nBins() == nBins) {
+    nRefFrames = min(m_reference->nFrames(), nFrames);
+    m_refRow.resize(nBins);
+  }
+  for (int i0 = begin; i0 < end; i0 += block) {
+    int n = min(block, end - i0);
+    for (int j = 0; j < n; j++) {
+      float *row = m_dBBlock.data() + (size_t)j * nBins;
+      frame_dB(m_parentSound, i0 + j, row);
+      if (!m_reference) {
+        continue;
       }
-      break;
-    case FreqScale::Bark:
-      for (int k = 0; k < nFFT / 2; k++) {
-        m_scaledIdx[k] =
-            (int)(bark2hz((double)k / (nFFT / 2.0) * (hz2bark(22050.0))) / fs *
-                  nFFT);
+      if (i0 + j < nRefFrames) {
+        frame_dB(m_reference, i0 + j, m_refRow.data());
+        for (int k = 0; k < nBins; k++) {
+          row[k] -= m_refRow[k];
+        }
+      } else {
+        fill(row, row + nBins, -HUGE_VALF);
       }
-      break;
-    case FreqScale::Mel:
-      for (int k = 0; k < nFFT / 2; k++) {
-        m_scaledIdx[k] =
-            (int)(mel2hz((double)k / (nFFT / 2.0) * (hz2mel(22050.0))) / fs *
-                  nFFT);
+    }
+    for (int k = 0; k < nBins; k++) {
+      float *dst = dB + (size_t)k * nFrames + i0;
+      for (int j = 0; j < n; j++) {
+        dst[j] = m_dBBlock[(size_t)j * nBins + k];
       }
+    }
+  }
+}
+
+void TFScene::setFreqScale(FreqScale type) {
+  if (type < 0 || type >= NumFreqScale) {
+    qDebug() << "Unsupported frequency scale type.";
+    qDebug() << "Force set to linear.";
+    type = FreqScale::Linear;
+  }
+  m_freqScale = type;
+  if (!m_parentSound) {
+    return;
+  }
+  m_tfMap->setFreqScale(type, m_parentSound->fs());
+  drawFreqTicks();
+  drawOverlay();
+  drawRegion();
+}
+
+// The same mapping the map is drawn with, so readouts and regions match the
+// pixel under the cursor on every scale.
+double TFScene::y2hz(double y) {
+  double fs = m_parentSound->fs();
+  double h = height();
+  return TFMapItem::freqFraction(m_freqScale, (h - y) / h, fs,
+                                 m_parentSound->nBins()) *
+         fs / 2.0;
+}
+
+// Kept in seconds and Hz, so it follows scale changes.
+void TFScene::drawRegion() {
+  if (m_regionT0 == m_regionT1 || m_regionF0 == m_regionF1) {
+    if (m_regionItem) {
+      m_regionItem->hide();
+    }
+    return;
+  }
+  if (!m_regionItem) {
+    QPen pen(QColor(Qt::white));
+    pen.setCosmetic(true);
+    m_regionItem = new QGraphicsRectItem();
+    m_regionItem->setPen(pen);
+    m_regionItem->setBrush(QColor(255, 255, 255, 40));
+    m_regionItem->setZValue(1.0);
+    addItem(m_regionItem);
+  }
+  double duration = m_parentSound->duration();
+  double x0 = m_regionT0 / duration * width();
+  double x1 = m_regionT1 / duration * width();
+  double y0 = hz2y(m_regionF0);
+  double y1 = hz2y(m_regionF1);
+  m_regionItem->setRect(QRectF(QPointF(min(x0, x1), min(y0, y1)),
+                               QPointF(max(x0, x1), max(y0, y1))));
+  m_regionItem->show();
+}
+
+// Inverse of TFMapItem::freqFraction for the current scale.
+double TFScene::hz2y(double hz) {
+  double fsHalf = m_parentSound->fs() / 2.0;
+  int nBins = m_parentSound->nBins();
+  double v;
+  switch (m_freqScale) {
+    case Log:
+      v = log(max(hz, 0.0) / fsHalf * nBins + 1.0) / log(nBins);
+      break;
+    case ERB:
+      v = hz2erb(hz) / hz2erb(fsHalf);
+      break;
+    case Bark:
+      v = hz2bark(hz) / hz2bark(fsHalf);
+      break;
+    case Mel:
+      v = hz2mel(hz) / hz2mel(fsHalf);
       break;
     default:
-      qDebug() << "Unsupported frequency scale type.";
-      qDebug() << "Force set to linear.";
-      for (int k = 0; k < nFFT / 2; k++) {
-        m_scaledIdx[k] = k;
-      }
+      v = hz / fsHalf;
       break;
   }
-  drawFreqTicks();
+  return height() - v * height();
 }
 
-void TFScene::genFreqIdx(FreqScale scaleType) {
-  if (!m_parentSound) {
+void TFScene::setEventMarks(const QPainterPath &path) {
+  if (!m_eventMarks) {
+    QPen pen(QColor(255, 220, 0));
+    pen.setCosmetic(true);
+    m_eventMarks = addPath(path, pen);
+    m_eventMarks->setZValue(1.5);
     return;
   }
-  int nFFT = m_parentSound->fft()->nFFT();
-  m_scaledIdx = new int[nFFT / 2];
-  setFreqScale(scaleType);
+  m_eventMarks->setPath(path);
+}
+
+void TFScene::setOverlay(int feature) {
+  m_overlayFeature = feature;
+  drawOverlay();
+}
+
+// Frequency features follow the frequency axis; the others are scaled to
+// their range over the file.
+void TFScene::drawOverlay() {
+  if (m_overlay) {
+    removeItem(m_overlay);
+    delete m_overlay;
+    m_overlay = nullptr;
+  }
+  if (!m_parentSound || m_overlayFeature < 0) {
+    return;
+  }
+  Features *features = m_parentSound->features();
+  Features::Feature feature = (Features::Feature)m_overlayFeature;
+  int c = features->column(feature);
+  float **values = features->values();
+  int nFrames = features->nFrames();
+  if (c < 0 || !values) {
+    return;
+  }
+  bool onFreqAxis =
+      feature == Features::Centroid || feature == Features::Rolloff;
+  double lo = HUGE_VAL;
+  double hi = -HUGE_VAL;
+  for (int i = 0; i < nFrames; i++) {
+    if (isfinite(values[i][c])) {
+      lo = min(lo, (double)values[i][c]);
+      hi = max(hi, (double)values[i][c]);
+    }
+  }
+  QPainterPath path;
+  bool drawing = false;
+  for (int i = 0; i < nFrames; i++) {
+    double v = values[i][c];
+    if (!isfinite(v)) {
+      drawing = false;
+      continue;
+    }
+    double x = (i + 0.5) * width() / nFrames;
+    double y = onFreqAxis ? hz2y(v)
+                          : height() * (1.0 - (hi > lo ? (v - lo) / (hi - lo)
+                                                       : 0.5));
+    if (drawing) {
+      path.lineTo(x, y);
+    } else {
+      path.moveTo(x, y);
+    }
+    drawing = true;
+  }
+  QPen pen(QColor(Qt::cyan));
+  pen.setCosmetic(true);
+  m_overlay = addPath(path, pen);
 }
 
 void TFScene::double2rgb(double x, unsigned char *r, unsigned char *g,
@@ -390,11 +836,64 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
   m_tfView = new TFView(this);
   m_tfScene = new TFScene(0, 0, 1200, 1024, this);
   m_tfView->setScene(m_tfScene);
+  m_compareView = new TFView(this);
+  m_compareScene = new TFScene(0, 0, 1200, 1024, this);
+  m_compareView->setScene(m_compareScene);
+  m_compareView->hide();
+  m_tfView->setPartner(m_compareView);
+  m_compareView->setPartner(m_tfView);
+  // Panning either view pans the other to the same time.
+  for (TFView *view : {m_tfView, m_compareView}) {
+    for (QScrollBar *bar :
+         {view->horizontalScrollBar(), view->verticalScrollBar()}) {
+      connect(bar, &QScrollBar::valueChanged, view, &TFView::syncPartner);
+    }
+  }
   m_waveView = new WaveView(0, 0, 1200, 100, this);
   m_pixmapLayout->addWidget(m_tfView);
+  m_pixmapLayout->addWidget(m_compareView);
   m_pixmapLayout->addWidget(m_waveView);
   m_upperLayout->addLayout(m_pixmapLayout);
   m_tfControllLayout = new QVBoxLayout();
+  m_methodComboBox = new QComboBox(this);
+  for (int i = 0; i < (int)Sound::NumTFMethod; i++) {
+    switch ((Sound::TFMethod)i) {
+      case Sound::TFMethod::STFT:
+        m_methodComboBox->addItem("STFT");
+        break;
+      case Sound::TFMethod::Reassigned:
+        m_methodComboBox->addItem("Reassigned");
+        break;
+      case Sound::TFMethod::ConstantQ:
+        m_methodComboBox->addItem("Constant-Q");
+        break;
+      case Sound::TFMethod::Wavelet:
+        m_methodComboBox->addItem("Wavelet");
+        break;
+      default:
+        break;
+    }
+  }
+  connect(m_methodComboBox, &QComboBox::currentIndexChanged, this,
+          &MainWindow::methodChangedHandler);
+  m_precisionComboBox = new QComboBox(this);
+  for (int p = 0; p < (int)Sound::NumPrecision; p++) {
+    switch ((Sound::Precision)p) {
+      case Sound::Precision::Double:
+        m_precisionComboBox->addItem("Double");
+        break;
+      case Sound::Precision::Single:
+        m_precisionComboBox->addItem("Single");
+        break;
+      case Sound::Precision::Mixed:
+        m_precisionComboBox->addItem("Mixed");
+        break;
+      default:
+        break;
+    }
+  }
+  connect(m_precisionComboBox, &QComboBox::currentIndexChanged, this,
+          &MainWindow::precisionChangedHandler);
   m_windowTypeComboBox = new QComboBox(this);
   for (int w = 0; w < (int)Window::NumWindow; w++) {
     switch ((Window::WindowType)w) {
@@ -421,6 +920,24 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
           &MainWindow::windowTypeChangedHandler);
   m_windowSizeComboBox = new QComboBox(this);
   m_windowSizeComboBox->addItems(m_windowSizeList);
+  m_windowSizeComboBox->setCurrentIndex(m_windowSizeList.indexOf("2048"));
+  m_fftSizeComboBox = new QComboBox(this);
+  m_fftSizeComboBox->addItem("Auto");
+  for (int n = 32; n <= 65536; n *= 2) {
+    for (int r : {1, 3, 5}) {
+      if (n * r <= 65536) {
+        m_fftSizeList.append(n * r);
+      }
+    }
+  }
+  sort(m_fftSizeList.begin(), m_fftSizeList.end());
+  for (int n : m_fftSizeList) {
+    m_fftSizeComboBox->addItem(QString::number(n));
+  }
+  m_zeroPaddingComboBox = new QComboBox(this);
+  for (int pad = 1; pad <= 8; pad *= 2) {
+    m_zeroPaddingComboBox->addItem(QString("x%1").arg(pad), pad);
+  }
   m_freqScaleComboBox = new QComboBox(this);
   for (int i = 0; i < (int)TFScene::FreqScale::NumFreqScale; i++) {
     switch ((TFScene::FreqScale)i) {
@@ -443,13 +960,69 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
         break;
     }
   }
+  m_tfControllLayout->addWidget(m_methodComboBox);
+  m_tfControllLayout->addWidget(m_precisionComboBox);
   m_tfControllLayout->addWidget(m_windowTypeComboBox);
   m_tfControllLayout->addWidget(m_windowSizeComboBox);
+  m_tfControllLayout->addWidget(m_fftSizeComboBox);
+  m_tfControllLayout->addWidget(m_zeroPaddingComboBox);
   m_tfControllLayout->addWidget(m_freqScaleComboBox);
+  m_overlayComboBox = new QComboBox(this);
+  m_overlayComboBox->addItem("No overlay");
+  for (int f = 0; f < (int)Features::Bands; f++) {
+    m_overlayComboBox->addItem(Features::name((Features::Feature)f));
+  }
+  m_tfControllLayout->addWidget(m_overlayComboBox);
+  m_compareComboBox = new QComboBox(this);
+  m_compareComboBox->addItem("Single");
+  m_compareComboBox->addItem("Difference");
+  m_compareComboBox->addItem("Side by side");
+  m_compareComboBox->setEnabled(false);
+  m_tfControllLayout->addWidget(m_compareComboBox);
+  m_floorLabel = new QLabel(this);
+  m_floorSlider = new QSlider(Qt::Horizontal, this);
+  m_floorSlider->setRange(-200, 50);
+  m_floorSlider->setValue(-120);
+  m_ceilLabel = new QLabel(this);
+  m_ceilSlider = new QSlider(Qt::Horizontal, this);
+  m_ceilSlider->setRange(-200, 50);
+  m_ceilSlider->setValue(0);
+  m_gammaLabel = new QLabel(this);
+  m_gammaSlider = new QSlider(Qt::Horizontal, this);
+  m_gammaSlider->setRange(10, 300);
+  m_gammaSlider->setValue(100);
+  m_autoRangeCheckBox = new QCheckBox("Auto range", this);
+  m_autoRangeCheckBox->setChecked(true);
+  m_tfControllLayout->addWidget(m_floorLabel);
+  m_tfControllLayout->addWidget(m_floorSlider);
+  m_tfControllLayout->addWidget(m_ceilLabel);
+  m_tfControllLayout->addWidget(m_ceilSlider);
+  m_tfControllLayout->addWidget(m_gammaLabel);
+  m_tfControllLayout->addWidget(m_gammaSlider);
+  m_tfControllLayout->addWidget(m_autoRangeCheckBox);
+  m_sliceView = new SliceView(this);
+  m_tfControllLayout->addWidget(m_sliceView);
+  connect(m_floorSlider, &QSlider::valueChanged, this,
+          &MainWindow::rangeSliderValueChangedHandler);
+  connect(m_ceilSlider, &QSlider::valueChanged, this,
+          &MainWindow::rangeSliderValueChangedHandler);
+  connect(m_gammaSlider, &QSlider::valueChanged, this,
+          &MainWindow::rangeSliderValueChangedHandler);
+  connect(m_autoRangeCheckBox, &QCheckBox::toggled, this,
+          &MainWindow::autoRangeToggledHandler);
+  applyDynamicRange();
   connect(m_windowSizeComboBox, &QComboBox::currentIndexChanged, this,
           &MainWindow::windowSizeChangedHandler);
+  connect(m_fftSizeComboBox, &QComboBox::currentIndexChanged, this,
+          &MainWindow::fftSizeChangedHandler);
+  connect(m_zeroPaddingComboBox, &QComboBox::currentIndexChanged, this,
+          &MainWindow::zeroPaddingChangedHandler);
   connect(m_freqScaleComboBox, &QComboBox::currentIndexChanged, this,
           &MainWindow::freqScaleChangedHandler);
+  connect(m_overlayComboBox, &QComboBox::currentIndexChanged, this,
+          &MainWindow::overlayChangedHandler);
+  connect(m_compareComboBox, &QComboBox::currentIndexChanged, this,
+          &MainWindow::compareModeChangedHandler);
   m_tfControllLayout->addStretch(0);
   m_upperLayout->addLayout(m_tfControllLayout);
   m_lowerLayout = new QHBoxLayout();
@@ -481,8 +1054,19 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
   m_audioSink.reset();
   m_playFlag = false;
   m_audioPlaybackTimer = new QTimer(this);
+  // Also moves the playhead, so it needs better than frame-rate accuracy.
+  m_audioPlaybackTimer->setTimerType(Qt::PreciseTimer);
   connect(m_audioPlaybackTimer, &QTimer::timeout, this,
           &MainWindow::playbackTimerTimeoutHandler);
+  m_eventTimer = new QTimer(this);
+  connect(m_eventTimer, &QTimer::timeout, this,
+          &MainWindow::eventTimerTimeoutHandler);
+  m_profileLabel = new QLabel(this);
+  statusBar()->addWidget(m_profileLabel);
+  m_profileTimer = new QTimer(this);
+  connect(m_profileTimer, &QTimer::timeout, this,
+          &MainWindow::profileTimerTimeoutHandler);
+  profileActionToggledHandler(Profiler::enabled());
 }
 
 MainWindow::~MainWindow() {}
@@ -492,63 +1076,314 @@ void MainWindow::createMenuBar() {
   m_menuFile = new QMenu("&File");
   m_openAction = new QAction("&Open", this);
   m_openAction->setShortcut(QKeySequence::Open);
+  m_compareAction = new QAction("&Compare with...", this);
   m_quitAction = new QAction("&Quit", this);
   m_quitAction->setShortcut(QKeySequence(Qt::CTRL | Qt::Key_Q));
+  m_exportAction = new QAction("&Export...", this);
   m_menuFile->addAction(m_openAction);
+  m_menuFile->addAction(m_compareAction);
+  m_menuFile->addAction(m_exportAction);
   m_menuFile->addSeparator();
   m_menuFile->addAction(m_quitAction);
   m_menuBar->addMenu(m_menuFile);
+  m_menuNavigate = new QMenu("&Navigate");
+  m_nextEventAction = new QAction("&Next event", this);
+  m_nextEventAction->setShortcut(QKeySequence(Qt::Key_N));
+  m_previousEventAction = new QAction("&Previous event", this);
+  m_previousEventAction->setShortcut(QKeySequence(Qt::SHIFT | Qt::Key_N));
+  m_menuNavigate->addAction(m_nextEventAction);
+  m_menuNavigate->addAction(m_previousEventAction);
+  m_menuBar->addMenu(m_menuNavigate);
+  connect(m_nextEventAction, &QAction::triggered, this,
+          &MainWindow::nextEventActionTriggeredHandler);
+  connect(m_previousEventAction, &QAction::triggered, this,
+          &MainWindow::previousEventActionTriggeredHandler);
+  m_menuDebug = new QMenu("&Debug");
+  m_profileAction = new QAction("&Profiling", this);
+  m_profileAction->setCheckable(true);
+  m_profileAction->setChecked(Profiler::enabled());
+  m_exportTraceAction = new QAction("&Export trace...", this);
+  m_menuDebug->addAction(m_profileAction);
+  m_menuDebug->addAction(m_exportTraceAction);
+  m_menuBar->addMenu(m_menuDebug);
+  connect(m_profileAction, &QAction::toggled, this,
+          &MainWindow::profileActionToggledHandler);
+  connect(m_exportTraceAction, &QAction::triggered, this,
+          &MainWindow::exportTraceActionTriggeredHandler);
   connect(m_openAction, &QAction::triggered, this,
           &MainWindow::openActionTriggeredHandler);
+  connect(m_compareAction, &QAction::triggered, this,
+          &MainWindow::compareActionTriggeredHandler);
+  connect(m_exportAction, &QAction::triggered, this,
+          &MainWindow::exportActionTriggeredHandler);
   connect(m_quitAction, &QAction::triggered, this,
           &MainWindow::quitActionTriggeredHandler);
   setMenuBar(m_menuBar);
 }
 
-void MainWindow::openActionTriggeredHandler() {
-  if (m_sound) {
-    delete m_sound;
+// Exports the STFT at the settings and hop of the current view.
+void MainWindow::exportActionTriggeredHandler() {
+  if (!m_sound) {
+    return;
+  }
+  QString npy = "NumPy arrays(*.npy)";
+  QString raw = "Raw float32(*.f32)";
+  QString png = "PNG tiles(*.png)";
+  QString filter = npy;
+  QString fname = QFileDialog::getSaveFileName(
+      this, "Export", "", npy + ";;" + raw + ";;" + png, &filter);
+  if (fname.isEmpty()) {
+    return;
   }
+  Exporter exporter(m_sound.data());
+  if (filter == raw) {
+    exporter.setFormat(Exporter::Raw);
+  } else if (filter == png) {
+    exporter.setFormat(Exporter::PngTiles);
+  }
+  exporter.setRange(m_floorSlider->value(), m_ceilSlider->value());
+  exporter.setColormap(TFScene::double2rgb);
+  QFileInfo info(fname);
+  QString base = info.path() + "/" + info.completeBaseName();
+  int hopSize = m_sound->nSamples() / m_tfScene->width();
+  bool ok = exporter.exportSTFT(
+      base.toStdString(), hopSize,
+      (Window::WindowType)m_windowTypeComboBox->currentIndex(),
+      m_windowSizeList[m_windowSizeComboBox->currentIndex()].toInt());
+  statusBar()->showMessage(
+      ok ? "Exported " + base + ".json" : "Cannot export " + fname, 3000);
+}
+
+void MainWindow::openActionTriggeredHandler() {
   QString fname = QFileDialog::getOpenFileName(
       this, "Select audio file", "", "WAV files(*.wav);;All file(*.*)");
-  m_sound = new Sound(fname.toStdString(), 1024,
-                      (Window::WindowType)m_windowTypeComboBox->currentIndex());
+  if (fname.isEmpty()) {
+    return;
+  }
+  QScopedPointer<Sound> sound(new Sound(
+      fname.toStdString(), 1024,
+      (Window::WindowType)m_windowTypeComboBox->currentIndex()));
+  if (!sound->loaded()) {
+    statusBar()->showMessage("Cannot read " + fname, 3000);
+    return;
+  }
+  // The stream and the scene point into the old sound; detach them first.
+  m_seekSec = 0.0;
+  streamStoppedHandler();
+  m_eventTimer->stop();
+  m_eventDetector.reset();
+  m_events = EventIndex();
+  m_audioSink.reset();
+  m_audioStream.reset();
+  m_tfScene->clearRegion();
+  m_tfScene->setReference(nullptr);
+  m_compareScene->setParentSound(nullptr);
+  m_compareSound.reset();
+  m_compareView->hide();
+  {
+    QSignalBlocker blocker(m_compareComboBox);
+    m_compareComboBox->setCurrentIndex(Single);
+    m_compareComboBox->setEnabled(false);
+  }
+  m_sound.swap(sound);
+  selectFeatures(m_sound.data());
+  m_soundPath = fname;
   m_waveView->init();
-  m_waveView->drawWaveForm(m_sound);
-  m_tfScene->setParentSound(m_sound);
-  m_tfScene->genFreqIdx(
+  m_waveView->drawWaveForm(m_sound.data());
+  m_tfScene->setParentSound(m_sound.data());
+  m_sliceView->setSound(m_sound.data());
+  updatePlayhead();
+  redrawTFMap();
+  m_tfScene->setFreqScale(
       (TFScene::FreqScale)m_freqScaleComboBox->currentIndex());
-  m_tfScene->setFlagModified();
-  m_tfScene->drawTFMap(
-      (Window::WindowType)m_windowTypeComboBox->currentIndex(),
-      m_windowSizeList[m_windowSizeComboBox->currentIndex()].toInt());
-  m_audioStream.reset(new AudioStream(m_sound));
+  m_audioStream.reset(new AudioStream(m_sound.data()));
   connect(m_audioStream.get(), &AudioStream::stopped, this,
           &MainWindow::streamStoppedHandler);
   m_audioStream->start();
+  // An index beside the file is used as long as it matches it; otherwise
+  // the events are found in the background and the index written there.
+  if (!m_events.load(EventIndex::sidecar(fname.toStdString()),
+                     m_sound->nSamples(), m_sound->fs())) {
+    m_eventDetector.reset(new EventDetector(m_audioStream->samples(),
+                                            m_audioStream->nSamples(),
+                                            m_sound->fs()));
+    m_eventTimer->start(200);
+  }
+  drawEvents();
   QAudioFormat audioFormat;
   audioFormat.setChannelCount(1);
-  audioFormat.setSampleRate(44100.0);
+  audioFormat.setSampleRate(m_sound->fs());
   audioFormat.setSampleFormat(QAudioFormat::Int16);
   m_audioSink.reset(
       new QAudioSink(m_audioDev->defaultAudioOutput(), audioFormat));
   m_audioIO = m_audioSink->start();
 }
 
+// The second file is analysed with the settings of the first, so it must
+// share its sample rate.
+void MainWindow::compareActionTriggeredHandler() {
+  if (!m_sound) {
+    return;
+  }
+  QString fname = QFileDialog::getOpenFileName(
+      this, "Select audio file to compare", "",
+      "WAV files(*.wav);;All file(*.*)");
+  if (fname.isEmpty()) {
+    return;
+  }
+  QScopedPointer<Sound> sound(new Sound(
+      fname.toStdString(), 1024,
+      (Window::WindowType)m_windowTypeComboBox->currentIndex()));
+  if (!sound->loaded()) {
+    statusBar()->showMessage("Cannot read " + fname, 3000);
+    return;
+  }
+  if (sound->fs() != m_sound->fs()) {
+    statusBar()->showMessage(
+        "Cannot compare " + fname + ": the sample rates differ", 3000);
+    return;
+  }
+  m_tfScene->setReference(nullptr);
+  m_compareScene->setParentSound(nullptr);
+  m_compareSound.swap(sound);
+  selectFeatures(m_compareSound.data());
+  m_compareScene->setParentSound(m_compareSound.data());
+  m_compareScene->setTimebase(m_sound.data());
+  m_compareScene->clearRegion();
+  {
+    QSignalBlocker blocker(m_compareComboBox);
+    m_compareComboBox->setEnabled(true);
+    if (m_compareComboBox->currentIndex() == Single) {
+      m_compareComboBox->setCurrentIndex(Difference);
+    }
+  }
+  compareModeChangedHandler(m_compareComboBox->currentIndex());
+}
+
 void MainWindow::quitActionTriggeredHandler() { close(); }
 
+void MainWindow::nextEventActionTriggeredHandler() {
+  if (!m_sound) {
+    return;
+  }
+  jumpToEvent(m_events.next(m_playFlag ? playheadTime() : m_seekSec));
+}
+
+void MainWindow::previousEventActionTriggeredHandler() {
+  if (!m_sound) {
+    return;
+  }
+  jumpToEvent(m_events.previous(m_playFlag ? playheadTime() : m_seekSec));
+}
+
+void MainWindow::eventTimerTimeoutHandler() {
+  if (!m_eventDetector) {
+    m_eventTimer->stop();
+    return;
+  }
+  if (!m_eventDetector->finished()) {
+    statusBar()->showMessage(
+        QString("Finding events: %1%")
+            .arg((int)(100.0 * m_eventDetector->progress())),
+        1000);
+    return;
+  }
+  m_eventTimer->stop();
+  m_events = m_eventDetector->index();
+  m_eventDetector.reset();
+  m_events.save(EventIndex::sidecar(m_soundPath.toStdString()));
+  drawEvents();
+  statusBar()->showMessage(
+      QString("%1 events").arg((int)m_events.events().size()), 3000);
+}
+
+// Markers span the waveform but only hang from the top of the map, so they
+// do not hide the spectrum.
+void MainWindow::drawEvents() {
+  double duration = m_sound->duration();
+  double waveWidth = m_waveView->scene()->width();
+  double waveHeight = m_waveView->scene()->height();
+  double mapWidth = m_tfScene->width();
+  QPainterPath wavePath;
+  QPainterPath mapPath;
+  for (const EventIndex::Event &e : m_events.events()) {
+    double frac = e.time / duration;
+    wavePath.moveTo(frac * waveWidth, 0.0);
+    wavePath.lineTo(frac * waveWidth, waveHeight);
+    mapPath.moveTo(frac * mapWidth, 0.0);
+    mapPath.lineTo(frac * mapWidth, 24.0);
+  }
+  m_waveView->scene()->setEventMarks(wavePath);
+  m_tfScene->setEventMarks(mapPath);
+}
+
+void MainWindow::jumpToEvent(int i) {
+  if (i < 0) {
+    statusBar()->showMessage(
+        m_events.events().empty() ? "No events" : "No more events", 2000);
+    return;
+  }
+  const EventIndex::Event &e = m_events.events()[i];
+  seek(e.time);
+  // A second either side, enough to see what led up to it.
+  double w = m_tfScene->width();
+  double x = e.time / m_sound->duration() * w;
+  double halfSpan = 1.0 / m_sound->duration() * w;
+  m_tfView->zoomTo(x - halfSpan, x + halfSpan);
+  statusBar()->showMessage(
+      QString("%1 at %2 s (%3 of %4)")
+          .arg(e.kind == EventIndex::Onset ? "Onset" : "Loud passage")
+          .arg(e.time, 0, 'f', 3)
+          .arg(i + 1)
+          .arg((int)m_events.events().size()),
+      3000);
+}
+
+void MainWindow::profileActionToggledHandler(bool checked) {
+  Profiler::setEnabled(checked);
+  m_profileLabel->setVisible(checked);
+  if (checked) {
+    m_profileTimer->start(500);
+  } else {
+    m_profileTimer->stop();
+  }
+}
+
+void MainWindow::exportTraceActionTriggeredHandler() {
+  QString fname = QFileDialog::getSaveFileName(
+      this, "Export trace", "tfy_trace.json", "JSON files(*.json)");
+  if (fname.isEmpty()) {
+    return;
+  }
+  if (!Profiler::writeChromeTrace(fname.toStdString())) {
+    statusBar()->showMessage("Cannot write " + fname, 3000);
+  }
+}
+
+void MainWindow::profileTimerTimeoutHandler() {
+  m_profileLabel->setText(QString::fromStdString(Profiler::summary()));
+}
+
 void MainWindow::playButtonClickedHandler() {
-  if (m_sound == nullptr) {
+  if (!m_sound) {
     return;
   }
   if (m_playFlag == false) {
     m_playFlag = true;
     m_playButton->setText("Pause");
+    if (m_audioSink->state() == QAudio::SuspendedState) {
+      m_audioSink->resume();
+      m_sinkRestarted = true;
+    } else {
+      startPlayback();
+    }
     m_audioPlaybackTimer->start(10);
   } else {
     m_playFlag = false;
     m_playButton->setText("Play");
     m_audioPlaybackTimer->stop();
+    // Holds what is already queued, and the sink clock with it.
+    m_audioSink->suspend();
   }
 }
 
@@ -556,15 +1391,94 @@ void MainWindow::streamStoppedHandler() {
   m_playButton->setText("Play");
   m_audioPlaybackTimer->stop();
   m_playFlag = false;
+  m_playStartSec = m_seekSec;
+  m_playhead = m_seekSec;
+  if (m_sound) {
+    updatePlayhead();
+  }
+}
+
+// Plays the region picked on the map if there is one, else the file from
+// the seek position. The sink is restarted, so nothing queued from before
+// is heard.
+void MainWindow::startPlayback() {
+  double t0;
+  double t1;
+  double f0;
+  double f1;
+  double start = m_seekSec;
+  if (m_tfScene->region(&t0, &t1, &f0, &f1)) {
+    m_audioStream->playRegion(t0, t1, f0, f1);
+    start = t0;
+  } else {
+    m_audioStream->playFile();
+    m_audioStream->setPos(2 * (int)(m_seekSec * m_sound->fs()));
+  }
+  m_audioSink->reset();
+  m_audioIO = m_audioSink->start();
+  m_playStartUSecs = m_audioSink->processedUSecs();
+  m_sinkRestarted = true;
+  m_playStartSec = start;
+  m_playhead = start;
+}
+
+void MainWindow::seek(double sec) {
+  m_seekSec = min(max(sec, 0.0), m_sound->duration());
+  if (m_playFlag) {
+    startPlayback();
+    return;
+  }
+  // A paused sink would resume where it was; drop it so Play starts here.
+  m_audioSink->reset();
+  m_playStartSec = m_seekSec;
+  m_playhead = m_seekSec;
+  updatePlayhead();
+}
+
+// processedUSecs() counts what the sink has taken from the stream; the part
+// still in its buffer has not been heard yet. The result never steps back,
+// so the playhead does not jitter when the two are sampled between
+// device periods.
+double MainWindow::playheadTime() {
+  if (m_audioSink.isNull() || !m_playFlag) {
+    return m_playhead;
+  }
+  qint64 queued = m_audioSink->format().durationForBytes(
+      m_audioSink->bufferSize() - m_audioSink->bytesFree());
+  double t = m_playStartSec +
+             (m_audioSink->processedUSecs() - m_playStartUSecs - queued) / 1e6;
+  m_playhead = max(m_playhead, t);
+  return m_playhead;
+}
+
+void MainWindow::updatePlayhead() {
+  double frac = min(max(playheadTime() / m_sound->duration(), 0.0), 1.0);
+  m_waveView->scene()->setCurrentStreamPosLine(
+      frac * m_waveView->scene()->width());
+  m_tfScene->setCurrentStreamPosLine(frac * m_tfScene->width());
+  if (m_compareSound) {
+    // Placed by time, which is where the same instant is in that view.
+    frac = min(max(playheadTime() / m_compareSound->duration(), 0.0), 1.0);
+    m_compareScene->setCurrentStreamPosLine(frac * m_compareScene->width());
+  }
 }
 
 void MainWindow::playbackTimerTimeoutHandler() {
   int len = m_audioSink->bytesFree();
+  if (m_sinkRestarted) {
+    m_sinkRestarted = false;
+  } else if (len == m_audioSink->bufferSize()) {
+    // The device drained everything since the last tick.
+    Profiler::add(Profiler::AudioUnderrun);
+  }
   QByteArray buf(len, 0);
   len = m_audioStream->read(buf.data(), len);
   if (len) {
     m_audioIO->write(buf.data(), len);
   }
+  if (m_playFlag) {
+    updatePlayhead();
+  }
 }
 
 void MainWindow::volSliderValueChangedHandler(int val) {
@@ -574,31 +1488,161 @@ void MainWindow::volSliderValueChangedHandler(int val) {
   m_audioSink->setVolume(val / 100.0);
 }
 
-void MainWindow::windowTypeChangedHandler(int val) {
+void MainWindow::redrawTFMap() {
   if (!m_sound) {
     return;
   }
-  m_tfScene->setFlagModified();
-  m_tfScene->drawTFMap(
-      (Window::WindowType)val,
-      m_windowSizeList[m_windowSizeComboBox->currentIndex()].toInt());
+  for (TFScene *scene : tfScenes()) {
+    scene->setFlagModified();
+    scene->drawTFMap(
+        (Window::WindowType)m_windowTypeComboBox->currentIndex(),
+        m_windowSizeList[m_windowSizeComboBox->currentIndex()].toInt());
+  }
+  updateAutoRange();
+}
+
+void MainWindow::methodChangedHandler(int val) {
+  for (TFScene *scene : {m_tfScene, m_compareScene}) {
+    scene->setMethod((Sound::TFMethod)val);
+  }
+  redrawTFMap();
+}
+
+void MainWindow::precisionChangedHandler(int val) {
+  for (TFScene *scene : {m_tfScene, m_compareScene}) {
+    scene->setPrecision((Sound::Precision)val);
+  }
+  redrawTFMap();
+}
+
+void MainWindow::windowTypeChangedHandler(int val) {
+  Q_UNUSED(val);
+  redrawTFMap();
 }
 
 void MainWindow::windowSizeChangedHandler(int val) {
+  Q_UNUSED(val);
+  redrawTFMap();
+}
+
+void MainWindow::fftSizeChangedHandler(int val) {
+  for (TFScene *scene : {m_tfScene, m_compareScene}) {
+    scene->setFFTSize(val ? m_fftSizeList[val - 1] : 0);
+  }
+  redrawTFMap();
+}
+
+void MainWindow::zeroPaddingChangedHandler(int val) {
+  for (TFScene *scene : {m_tfScene, m_compareScene}) {
+    scene->setZeroPadding(m_zeroPaddingComboBox->itemData(val).toInt());
+  }
+  redrawTFMap();
+}
+
+void MainWindow::freqScaleChangedHandler(int val) {
   if (!m_sound) {
     return;
   }
-  m_tfScene->setFlagModified();
-  m_tfScene->drawTFMap((Window::WindowType)m_windowTypeComboBox->currentIndex(),
-                       m_windowSizeList[val].toInt());
+  for (TFScene *scene : tfScenes()) {
+    scene->setFreqScale((TFScene::FreqScale)val);
+  }
 }
 
-void MainWindow::freqScaleChangedHandler(int val) {
+void MainWindow::overlayChangedHandler(int val) {
+  for (Sound *sound : {m_sound.data(), m_compareSound.data()}) {
+    if (sound) {
+      selectFeatures(sound);
+    }
+  }
+  for (TFScene *scene : {m_tfScene, m_compareScene}) {
+    scene->setOverlay(val - 1);
+  }
+}
+
+// The STFT computes nothing else, so a new selection is filled in from the
+// stored spectrum rather than by a new analysis.
+void MainWindow::selectFeatures(Sound *sound) {
+  int selected = m_overlayComboBox->currentIndex() - 1;
+  Features *features = sound->features();
+  for (int f = 0; f < Features::NumFeature; f++) {
+    features->setEnabled((Features::Feature)f, f == selected);
+  }
+  sound->updateFeatures();
+}
+
+// Difference draws the first file minus the second on the main map; side
+// by side shows the second below the first, zoomed, panned and played
+// along with it.
+void MainWindow::compareModeChangedHandler(int val) {
   if (!m_sound) {
     return;
   }
-  m_tfScene->setFreqScale((TFScene::FreqScale)val);
-  m_tfScene->drawTFMap(
-      (Window::WindowType)val,
-      m_windowSizeList[m_windowSizeComboBox->currentIndex()].toInt());
+  Sound *other = m_compareSound.data();
+  m_tfScene->setReference(val == Difference ? other : nullptr);
+  bool sideBySide = val == SideBySide && other;
+  bool shown = sideBySide && m_compareView->isHidden();
+  m_compareView->setVisible(sideBySide);
+  if (shown) {
+    m_tfView->syncPartner();
+  }
+  redrawTFMap();
+  for (TFScene *scene : tfScenes()) {
+    scene->setFreqScale(
+        (TFScene::FreqScale)m_freqScaleComboBox->currentIndex());
+  }
+  updatePlayhead();
+}
+
+QList<TFScene *> MainWindow::tfScenes() {
+  QList<TFScene *> scenes = {m_tfScene};
+  if (!m_compareView->isHidden()) {
+    scenes.append(m_compareScene);
+  }
+  return scenes;
+}
+
+void MainWindow::rangeSliderValueChangedHandler(int val) {
+  Q_UNUSED(val);
+  QSignalBlocker blocker(m_autoRangeCheckBox);
+  m_autoRangeCheckBox->setChecked(false);
+  applyDynamicRange();
+}
+
+void MainWindow::autoRangeToggledHandler(bool checked) {
+  if (checked) {
+    updateAutoRange();
+  }
+}
+
+// Floor and ceiling come from the level histogram of the last STFT, so a
+// few loud clicks do not flatten the whole picture.
+void MainWindow::updateAutoRange() {
+  if (!m_sound || !m_autoRangeCheckBox->isChecked()) {
+    return;
+  }
+  double upper_dB = m_sound->specPercentile(0.999);
+  double lower_dB = max(m_sound->specPercentile(0.1), upper_dB - 120.0);
+  if (m_compareSound && m_compareComboBox->currentIndex() == Difference) {
+    // Levels are differences; an even range shows which file is louder.
+    upper_dB = 24.0;
+    lower_dB = -24.0;
+  }
+  QSignalBlocker floorBlocker(m_floorSlider);
+  QSignalBlocker ceilBlocker(m_ceilSlider);
+  m_floorSlider->setValue((int)floor(lower_dB));
+  m_ceilSlider->setValue((int)ceil(upper_dB));
+  applyDynamicRange();
+}
+
+void MainWindow::applyDynamicRange() {
+  double lower_dB = m_floorSlider->value();
+  double upper_dB = max(m_ceilSlider->value(), m_floorSlider->value() + 1);
+  double gamma = m_gammaSlider->value() / 100.0;
+  m_floorLabel->setText(QString("Floor: %1 dB").arg(lower_dB));
+  m_ceilLabel->setText(QString("Ceiling: %1 dB").arg(upper_dB));
+  m_gammaLabel->setText(QString("Gamma: %1").arg(gamma, 0, 'f', 2));
+  for (TFScene *scene : {m_tfScene, m_compareScene}) {
+    scene->setDynamicRange(lower_dB, upper_dB, gamma);
+  }
+  m_sliceView->setRange(lower_dB, upper_dB);
 }
\ No newline at end of file
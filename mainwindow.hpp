@@ -2,8 +2,11 @@
 
 #include <QAction>
 #include <QAudioSink>
+#include <QCheckBox>
 #include <QComboBox>
 #include <QGraphicsItemGroup>
+#include <QGraphicsPathItem>
+#include <QGraphicsRectItem>
 #include <QGraphicsScene>
 #include <QGraphicsSceneMouseEvent>
 #include <QGraphicsView>
@@ -15,25 +18,50 @@
 #include <QMenuBar>
 #include <QPushButton>
 #include <QScopedPointer>
+#include <QScrollBar>
 #include <QSlider>
+#include <QStatusBar>
 #include <QTimer>
 #include <QVBoxLayout>
+#include <QWheelEvent>
 #include <QWidget>
 
+#include "events.hpp"
 #include "playback.hpp"
+#include "sliceview.hpp"
 #include "sound.hpp"
+#include "tfmap.hpp"
 
 class MainWindow;
+
+// Vertical line at the playback position. It is added once and only moved,
+// so each step invalidates its old and new strips and nothing else.
+class PlayheadItem : public QGraphicsItem {
+ public:
+  PlayheadItem(double h) { m_h = h; }
+  QRectF boundingRect() const override { return QRectF(-1.0, 0.0, 2.0, m_h); }
+  void paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+             QWidget *widget) override;
+
+ private:
+  double m_h;
+};
+
 class WaveScene : public QGraphicsScene {
  public:
   WaveScene(int x, int y, int w, int h, MainWindow *parent);
   void setCurrentStreamPosLine(double x);
   QGraphicsItem *currentStreamPosLine() { return m_currentStreamPosLine; }
+  // Replaces the event markers with path, in scene coordinates.
+  void setEventMarks(const QPainterPath &path);
+  QGraphicsItem *eventMarks() { return m_eventMarks; }
+  void mousePressEvent(QGraphicsSceneMouseEvent *e) override;
   void mouseMoveEvent(QGraphicsSceneMouseEvent *e) override;
 
  private:
   MainWindow *m_parent;
   QGraphicsItem *m_currentStreamPosLine = nullptr;
+  QGraphicsPathItem *m_eventMarks = nullptr;
 };
 
 class WaveView : public QGraphicsView {
@@ -52,8 +80,22 @@ class TFView : public QGraphicsView {
  public:
   TFView(QWidget *parent);
   ~TFView();
+  void wheelEvent(QWheelEvent *e) override;
+  // Zooming or panning here shows the same stretch of time in partner.
+  void setPartner(TFView *partner) { m_partner = partner; }
+  // Scales horizontally so scene x0 .. x1 fills the view, and centres it.
+  void zoomTo(double x0, double x1);
+  void syncPartner();
+
+ protected:
+  void scrollContentsBy(int dx, int dy) override;
+  void resizeEvent(QResizeEvent *e) override;
 
  private:
+  void viewChanged();
+  TFView *m_partner = nullptr;
+  // Set while partner moves this view, which then does not move it back.
+  bool m_following = false;
 };
 
 class TFScene : public QGraphicsScene {
@@ -63,12 +105,47 @@ class TFScene : public QGraphicsScene {
   enum FreqScale { Linear, Log, ERB, Bark, Mel, NumFreqScale };
   void drawTFMap(Window::WindowType windowType, int windowSize);
   void setFreqScale(FreqScale type);
+  void setDynamicRange(double lower_dB, double upper_dB, double gamma);
   void setFlagModified() { m_flagModified = true; }
-  void genFreqIdx(FreqScale scaleType);
+  void setMethod(Sound::TFMethod method) { m_method = method; }
+  void setPrecision(Sound::Precision precision) { m_precision = precision; }
+  // 0 selects windowSize * zero padding.
+  void setFFTSize(int nFFT) { m_nFFT = nFFT; }
+  void setZeroPadding(int factor) { m_zeroPadding = factor; }
   void setCurrentStreamPosLine(double x);
   void setParentSound(Sound *sound) { m_parentSound = sound; }
+  Sound *parentSound() { return m_parentSound; }
+  // Shows the parent sound beside the scene of main, analysed at its hop so
+  // frame i of both is the same instant. The slice view and the played
+  // region belong to main, so hovering here leaves the slice view alone and
+  // Shift+drag pans like a plain drag. nullptr makes the scene a main one.
+  void setTimebase(Sound *main) {
+    m_timebase = main;
+    m_flagModified = true;
+  }
+  Sound *timebase() { return m_timebase; }
+  // Draws the parent sound minus reference, in dB, both analysed at the
+  // parent's hop; nullptr draws the parent sound alone.
+  void setReference(Sound *reference) {
+    m_reference = reference;
+    m_flagModified = true;
+  }
+  // Draws one Features::Feature of the last STFT over the map; -1 hides it.
+  void setOverlay(int feature);
+  // Replaces the event markers with path, in scene coordinates.
+  void setEventMarks(const QPainterPath &path);
+  // The visible part of the scene moved; computes what it now shows.
+  void viewChanged();
+  // Time-frequency rectangle dragged out with Shift held, in s and Hz; false
+  // if there is none.
+  bool region(double *t0, double *t1, double *f0, double *f1);
+  void clearRegion();
+  void mousePressEvent(QGraphicsSceneMouseEvent *e) override;
   void mouseMoveEvent(QGraphicsSceneMouseEvent *e) override;
+  void mouseReleaseEvent(QGraphicsSceneMouseEvent *e) override;
   void drawFreqTicks();
+  double hz2y(double hz);
+  double y2hz(double y);
   static double hz2erb(double hz) { return 21.3 * log10(1.0 + 0.00437 * hz); }
   static double erb2hz(double erb) {
     return ((pow(10.0, erb / 21.3) - 1.0) / 0.00437);
@@ -87,21 +164,42 @@ class TFScene : public QGraphicsScene {
     }
     return 1960.0 * (barkNew + 0.53) / (26.28 - barkNew);
   }
-  static double hz2mel(double hz) { return 2595.0 * log10(1.0 + hz / 700.0); }
-  static double mel2hz(double mel) {
-    return 700.0 * (pow(10.0, mel / 2595.0) - 1.0);
-  }
+  static void double2rgb(const double x, unsigned char *r, unsigned char *g,
+                         unsigned char *b);
 
  private:
-  void double2rgb(const double x, unsigned char *r, unsigned char *g,
-                  unsigned char *b);
+  void resetMagnitude();
+  void updateMagnitude(int begin, int end);
+  void visibleFrames(int *i0, int *i1, int *center);
+  bool frameReady(int i);
+  int nPending();
+  void fillStep();
+  void drawOverlay();
+  void drawRegion();
+  AlignedBuffer<float> m_dBBlock;
+  AlignedBuffer<float> m_refRow;
   MainWindow *m_parent;
   QGraphicsItem *m_currentStreamPosLine = nullptr;
   QGraphicsItemGroup *m_ticks = nullptr;
-  unsigned char *m_data;
+  QGraphicsPathItem *m_overlay = nullptr;
+  QGraphicsPathItem *m_eventMarks = nullptr;
+  int m_overlayFeature = -1;
+  QGraphicsRectItem *m_regionItem = nullptr;
+  bool m_dragging = false;
+  double m_regionT0 = 0.0;
+  double m_regionT1 = 0.0;
+  double m_regionF0 = 0.0;
+  double m_regionF1 = 0.0;
+  QTimer *m_fillTimer;
+  TFMapItem *m_tfMap;
   Sound *m_parentSound = nullptr;
+  Sound *m_reference = nullptr;
+  Sound *m_timebase = nullptr;
   FreqScale m_freqScale = Linear;
-  int *m_scaledIdx = nullptr;
+  Sound::TFMethod m_method = Sound::STFT;
+  Sound::Precision m_precision = Sound::Double;
+  int m_nFFT = 0;
+  int m_zeroPadding = 1;
   bool m_flagModified;
 };
 
@@ -113,36 +211,97 @@ class MainWindow : public QMainWindow {
   ~MainWindow();
   QLabel *freqLabel() { return m_freqLabel; }
   QLabel *timeLabel() { return m_timeLabel; }
-  Sound *sound() { return m_sound; }
+  SliceView *sliceView() { return m_sliceView; }
+  // Seconds into the file of the sample being heard.
+  double playheadTime();
+  // Moves the start of whole-file playback, or restarts it there if running.
+  void seek(double sec);
+  void updateAutoRange();
+  Sound *sound() { return m_sound.data(); }
 
  public slots:
   void openActionTriggeredHandler();
+  void compareActionTriggeredHandler();
   void quitActionTriggeredHandler();
+  void profileActionToggledHandler(bool checked);
+  void exportTraceActionTriggeredHandler();
+  void exportActionTriggeredHandler();
+  void nextEventActionTriggeredHandler();
+  void previousEventActionTriggeredHandler();
+  void eventTimerTimeoutHandler();
+  void profileTimerTimeoutHandler();
   void playButtonClickedHandler();
   void streamStoppedHandler();
   void playbackTimerTimeoutHandler();
   void volSliderValueChangedHandler(int val);
+  void methodChangedHandler(int val);
+  void precisionChangedHandler(int val);
   void windowTypeChangedHandler(int val);
   void windowSizeChangedHandler(int val);
+  void fftSizeChangedHandler(int val);
+  void zeroPaddingChangedHandler(int val);
   void freqScaleChangedHandler(int val);
+  void overlayChangedHandler(int val);
+  void compareModeChangedHandler(int val);
+  void rangeSliderValueChangedHandler(int val);
+  void autoRangeToggledHandler(bool checked);
 
  private:
+  enum CompareMode { Single, Difference, SideBySide };
   void createMenuBar();
+  // Scenes that take the analysis settings: the main one, and the second
+  // file's when it is shown.
+  QList<TFScene *> tfScenes();
+  void redrawTFMap();
+  void applyDynamicRange();
+  // Enables on sound only the feature drawn over the map, if any.
+  void selectFeatures(Sound *sound);
+  void updatePlayhead();
+  void startPlayback();
+  void drawEvents();
+  // Seeks to event i of m_events and zooms the map around it.
+  void jumpToEvent(int i);
   QMenuBar *m_menuBar;
   QMenu *m_menuFile;
   QAction *m_openAction;
+  QAction *m_compareAction;
+  QAction *m_exportAction;
   QAction *m_quitAction;
+  QMenu *m_menuNavigate;
+  QAction *m_nextEventAction;
+  QAction *m_previousEventAction;
+  QMenu *m_menuDebug;
+  QAction *m_profileAction;
+  QAction *m_exportTraceAction;
+  QLabel *m_profileLabel;
+  QTimer *m_profileTimer;
   QWidget *m_centralWidget;
   QVBoxLayout *m_topLayout;
   QHBoxLayout *m_upperLayout;
   QVBoxLayout *m_pixmapLayout;
   TFView *m_tfView;
   TFScene *m_tfScene;
+  TFView *m_compareView;
+  TFScene *m_compareScene;
   WaveView *m_waveView;
   QVBoxLayout *m_tfControllLayout;
+  QComboBox *m_methodComboBox;
+  QComboBox *m_precisionComboBox;
   QComboBox *m_windowTypeComboBox;
   QComboBox *m_windowSizeComboBox;
+  QComboBox *m_fftSizeComboBox;
+  QComboBox *m_zeroPaddingComboBox;
   QComboBox *m_freqScaleComboBox;
+  QComboBox *m_overlayComboBox;
+  QComboBox *m_compareComboBox;
+  QLabel *m_floorLabel;
+  QSlider *m_floorSlider;
+  QLabel *m_ceilLabel;
+  QSlider *m_ceilSlider;
+  QLabel *m_gammaLabel;
+  QSlider *m_gammaSlider;
+  QCheckBox *m_autoRangeCheckBox;
+  SliceView *m_sliceView;
   QHBoxLayout *m_lowerLayout;
   QLabel *m_freqLabel;
   QLabel *m_HzLabel;
@@ -150,13 +309,32 @@ class MainWindow : public QMainWindow {
   QLabel *m_secLabel;
   QSlider *m_volSlider;
   QPushButton *m_playButton;
-  Sound *m_sound = nullptr;
+  QScopedPointer<Sound> m_sound;
+  QString m_soundPath;
+  // Second file of compare mode, at the sample rate of the first.
+  QScopedPointer<Sound> m_compareSound;
   QMediaDevices *m_audioDev;
   QTimer *m_audioPlaybackTimer;
   QScopedPointer<AudioStream> m_audioStream;
+  // Reads the samples of m_audioStream, so it is declared after it and
+  // goes first.
+  QScopedPointer<EventDetector> m_eventDetector;
+  QTimer *m_eventTimer;
+  EventIndex m_events;
   QScopedPointer<QAudioSink> m_audioSink;
   QIODevice *m_audioIO;
   bool m_playFlag;
-  QStringList m_windowSizeList = {"2048", "1024", "512", "256",
-                                  "128",  "64",   "32"};
+  // Sink clock and file position when playback last started from a stop.
+  qint64 m_playStartUSecs = 0;
+  // The sink was just started or resumed, so its buffer is empty on the
+  // next tick without any underrun.
+  bool m_sinkRestarted = false;
+  double m_playStartSec = 0.0;
+  double m_playhead = 0.0;
+  // Where whole-file playback starts from a stop.
+  double m_seekSec = 0.0;
+  QStringList m_windowSizeList = {"65536", "32768", "16384", "8192",
+                                  "4096",  "2048",  "1024",  "512",
+                                  "256",   "128",   "64",    "32"};
+  QList<int> m_fftSizeList;
 };
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cmath>
+
+// The mel scale of O'Shaughnessy, shared by the map's frequency axis and the
+// mel band export so the two agree.
+inline double hz2mel(double hz) { return 2595.0 * log10(1.0 + hz / 700.0); }
+
+inline double mel2hz(double mel) {
+  return 700.0 * (pow(10.0, mel / 2595.0) - 1.0);
+}
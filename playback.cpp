@@ -20,7 +20,20 @@ void AudioStream::readAudioData() {
   }
 }
 
+void AudioStream::playRegion(double t0, double t1, double f0, double f1) {
+  m_resynth.reset(
+      new Resynth(samples(), nSamples(), m_sound->fs(), t0, t1, f0, f1));
+}
+
 qint64 AudioStream::readData(char *data, qint64 len) {
+  if (m_resynth) {
+    // Whatever the worker has rendered so far; the rest comes next tick.
+    int n = m_resynth->read(reinterpret_cast<int16_t *>(data), len / 2);
+    if (n == 0 && m_resynth->finished()) {
+      emit stopped();
+    }
+    return 2 * n;
+  }
   qint64 total = 0;
   if (!m_buf.isEmpty()) {
     while (len - total > 0) {
@@ -2,7 +2,9 @@
 
 #include <QByteArray>
 #include <QIODevice>
+#include <QScopedPointer>
 
+#include "resynth.hpp"
 #include "sound.hpp"
 
 class AudioStream : public QIODevice {
@@ -28,10 +30,22 @@ class AudioStream : public QIODevice {
     return m_buf.size() + QIODevice::bytesAvailable();
   }
   qint64 size() const override { return m_buf.size(); }
+  // The file as played, one 16-bit sample per frame; valid while this
+  // object lives.
+  const int16_t *samples() const {
+    return reinterpret_cast<const int16_t *>(m_buf.constData());
+  }
+  int nSamples() const { return m_buf.size() / 2; }
   void setPos(int pos) { m_pos = pos; }
+  // From now on reads t0..t1 s of the file with only f0..f1 Hz left in, and
+  // emits stopped() once that has all been read.
+  void playRegion(double t0, double t1, double f0, double f1);
+  // Back to the whole file, from the byte offset last given to setPos().
+  void playFile() { m_resynth.reset(); }
 
  private:
   int m_pos = 0;
+  QScopedPointer<Resynth> m_resynth;
   QByteArray m_buf;
   Sound *m_sound;
 };
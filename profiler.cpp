@@ -0,0 +1,116 @@
+#include "profiler.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+using namespace std;
+
+atomic<bool> Profiler::s_enabled(getenv("TFY_PROFILE") != nullptr);
+atomic<long> Profiler::s_counters[Profiler::NumCounter];
+mutex Profiler::s_mutex;
+vector<Profiler::Event> Profiler::s_events;
+
+static int threadIndex() {
+  static atomic<int> next(0);
+  thread_local int index = next++;
+  return index;
+}
+
+void Profiler::setEnabled(bool enabled) {
+  s_enabled.store(enabled, memory_order_relaxed);
+}
+
+long long Profiler::now() {
+  static const chrono::steady_clock::time_point start =
+      chrono::steady_clock::now();
+  return chrono::duration_cast<chrono::microseconds>(
+             chrono::steady_clock::now() - start)
+      .count();
+}
+
+void Profiler::addEvent(const char *name, long long begin, long long end) {
+  lock_guard<mutex> lock(s_mutex);
+  if (s_events.size() < maxEvents) {
+    s_events.push_back({name, begin, end, threadIndex()});
+  }
+}
+
+const char *Profiler::counterName(Counter counter) {
+  switch (counter) {
+    case Counter::FFTExec:
+      return "FFT exec";
+    case Counter::FFTTransform:
+      return "FFT transform";
+    case Counter::AudioUnderrun:
+      return "Underruns";
+    case Counter::SampleBytes:
+      return "Sample bytes";
+    case Counter::SpecBytes:
+      return "Spectrum bytes";
+    case Counter::TextureBytes:
+      return "Texture bytes";
+    case Counter::BufferAlloc:
+      return "Buffer allocations";
+    default:
+      return "Unknown";
+  }
+}
+
+void Profiler::clear() {
+  lock_guard<mutex> lock(s_mutex);
+  s_events.clear();
+  for (atomic<long> &counter : s_counters) {
+    counter.store(0);
+  }
+}
+
+string Profiler::summary() {
+  map<string, long long> latest;
+  {
+    lock_guard<mutex> lock(s_mutex);
+    for (const Event &e : s_events) {
+      latest[e.name] = e.end - e.begin;
+    }
+  }
+  ostringstream out;
+  out.setf(ios::fixed);
+  out.precision(1);
+  for (auto &stage : latest) {
+    out << stage.first << " " << stage.second / 1000.0 << " ms | ";
+  }
+  for (int c = 0; c < NumCounter; c++) {
+    out << counterName((Counter)c) << " " << counter((Counter)c);
+    if (c < NumCounter - 1) {
+      out << " | ";
+    }
+  }
+  return out.str();
+}
+
+bool Profiler::writeChromeTrace(const string &fname) {
+  ofstream fout(fname);
+  if (!fout) {
+    return false;
+  }
+  lock_guard<mutex> lock(s_mutex);
+  fout << "{\"traceEvents\":[";
+  bool first = true;
+  for (const Event &e : s_events) {
+    fout << (first ? "" : ",") << "\n{\"name\":\"" << e.name
+         << "\",\"ph\":\"X\",\"ts\":" << e.begin
+         << ",\"dur\":" << e.end - e.begin << ",\"pid\":1,\"tid\":" << e.tid
+         << "}";
+    first = false;
+  }
+  long long ts = now();
+  for (int c = 0; c < NumCounter; c++) {
+    fout << (first ? "" : ",") << "\n{\"name\":\"" << counterName((Counter)c)
+         << "\",\"ph\":\"C\",\"ts\":" << ts
+         << ",\"pid\":1,\"args\":{\"value\":" << counter((Counter)c) << "}}";
+    first = false;
+  }
+  fout << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return (bool)fout;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Process-wide timing and counter collection. While disabled, every hook
+// costs one relaxed atomic load. The byte counts are gauges, kept by set()
+// whether or not profiling is on so they are current once it is enabled.
+class Profiler {
+ public:
+  enum Counter {
+    FFTExec,
+    FFTTransform,
+    AudioUnderrun,
+    SampleBytes,
+    SpecBytes,
+    TextureBytes,
+    BufferAlloc,
+    NumCounter
+  };
+  static bool enabled() { return s_enabled.load(memory_order_relaxed); }
+  static void setEnabled(bool enabled);
+  static long long now();
+  static void addEvent(const char *name, long long begin, long long end);
+  static void add(Counter counter, long n = 1) {
+    if (enabled()) {
+      s_counters[counter].fetch_add(n, memory_order_relaxed);
+    }
+  }
+  static void set(Counter counter, long n) {
+    s_counters[counter].store(n, memory_order_relaxed);
+  }
+  static long counter(Counter counter) { return s_counters[counter].load(); }
+  static const char *counterName(Counter counter);
+  static void clear();
+  // One line with the latest duration of every stage and the counters.
+  static string summary();
+  // Chrome trace event format, viewable in chrome://tracing or Perfetto.
+  static bool writeChromeTrace(const string &fname);
+
+ private:
+  struct Event {
+    const char *name;
+    long long begin;
+    long long end;
+    int tid;
+  };
+  static const size_t maxEvents = 1 << 20;
+  static atomic<bool> s_enabled;
+  static atomic<long> s_counters[NumCounter];
+  static mutex s_mutex;
+  static vector<Event> s_events;
+};
+
+class ScopedTimer {
+ public:
+  ScopedTimer(const char *name) {
+    if (Profiler::enabled()) {
+      m_name = name;
+      m_begin = Profiler::now();
+    }
+  }
+  ~ScopedTimer() {
+    if (m_name) {
+      Profiler::addEvent(m_name, m_begin, Profiler::now());
+    }
+  }
+
+ private:
+  const char *m_name = nullptr;
+  long long m_begin = 0;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) \
+  ScopedTimer PROFILE_CONCAT(profileScope, __LINE__)(name)
@@ -0,0 +1,141 @@
+#include "resynth.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#include "profiler.hpp"
+
+using namespace std;
+
+Resynth::Resynth(const int16_t *x, int nSamples, int fs, double t0, double t1,
+                 double f0, double f1, int nFFT) {
+  m_x = x;
+  m_nSamples = nSamples;
+  m_fs = fs;
+  m_n0 = min(max((int)(min(t0, t1) * fs), 0), nSamples);
+  m_n1 = min(max((int)(max(t0, t1) * fs), m_n0), nSamples);
+  m_f0 = min(f0, f1);
+  m_f1 = max(f0, f1);
+  m_nFFT = FFT::fastSize(max(nFFT, 16));
+  // 5 ms, against clicks at the cuts.
+  m_nFade = min(fs / 200, (m_n1 - m_n0) / 2);
+  // A quarter of a second ahead of the reader.
+  m_ring.resize(max(fs / 4, m_nFFT));
+  m_worker = thread(&Resynth::run, this);
+}
+
+Resynth::~Resynth() {
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_space.notify_all();
+  m_worker.join();
+}
+
+int Resynth::read(int16_t *out, int n) {
+  int count;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    count = (int)min((long)n, m_written - m_read);
+    for (int i = 0; i < count; i++) {
+      out[i] = m_ring[(m_read + i) % m_ring.size()];
+    }
+    m_read += count;
+  }
+  if (count) {
+    m_space.notify_one();
+  }
+  return count;
+}
+
+bool Resynth::finished() {
+  lock_guard<mutex> lock(m_mutex);
+  return m_done && m_read == m_written;
+}
+
+// Blocks while the ring is full; false when the object is going away.
+bool Resynth::push(const double *y, int n) {
+  long size = m_ring.size();
+  int i = 0;
+  while (i < n) {
+    unique_lock<mutex> lock(m_mutex);
+    m_space.wait(lock, [&] { return m_stop || m_written - m_read < size; });
+    if (m_stop) {
+      return false;
+    }
+    int count = (int)min((long)(n - i), size - (m_written - m_read));
+    for (int j = 0; j < count; j++) {
+      double v = round(y[i + j] * (SHRT_MAX + 1.0));
+      m_ring[(m_written + j) % size] =
+          (int16_t)min(max(v, (double)SHRT_MIN), (double)SHRT_MAX);
+    }
+    m_written += count;
+    i += count;
+  }
+  return true;
+}
+
+// Frame p covers samples p .. p + nFFT - 1 and frames start every hop, so
+// once frame p is added, samples p .. p + hop - 1 have all their terms.
+// Analysis and synthesis both use the periodic Hann window, whose square
+// sums to a constant at a hop of nFFT / 4.
+void Resynth::run() {
+  PROFILE_SCOPE("Resynthesis");
+  int nFFT = m_nFFT;
+  int hop = nFFT / 4;
+  FFT fft(nFFT, Window::WindowType::Hann, m_fs);
+  const double *w = fft.window()->data();
+  double gain = 0.0;
+  for (int n = 0; n < nFFT; n++) {
+    gain += w[n] * w[n];
+  }
+  gain /= hop;
+  int kLo = max((int)ceil(m_f0 * nFFT / m_fs), 0);
+  int kHi = min((int)floor(m_f1 * nFFT / m_fs), nFFT / 2);
+  AlignedBuffer<double> in(nFFT);
+  AlignedBuffer<double> acc(nFFT);
+  AlignedBuffer<double> block(hop);
+  AlignedBuffer<complex<double>> X(nFFT);
+  AlignedBuffer<complex<double>> y(nFFT);
+  fill(acc.begin(), acc.end(), 0.0);
+  for (int p = m_n0 - nFFT + hop; p < m_n1; p += hop) {
+    for (int n = 0; n < nFFT; n++) {
+      int s = p + n;
+      in[n] = s >= 0 && s < m_nSamples ? m_x[s] / (SHRT_MAX + 1.0) * w[n]
+                                       : 0.0;
+    }
+    fft.transform(in.data(), X.data());
+    for (int k = 0; k < nFFT; k++) {
+      int kk = k <= nFFT / 2 ? k : nFFT - k;
+      if (kk < kLo || kk > kHi) {
+        X[k] = 0.0;
+      }
+    }
+    fft.inverse(X.data(), y.data());
+    for (int n = 0; n < nFFT; n++) {
+      acc[n] += real(y[n]) * w[n] / gain;
+    }
+    int count = 0;
+    for (int j = 0; j < hop; j++) {
+      int s = p + j;
+      if (s < m_n0 || s >= m_n1) {
+        continue;
+      }
+      double fade = 1.0;
+      if (m_nFade > 0) {
+        fade = min(min(s - m_n0, m_n1 - 1 - s) / (double)m_nFade, 1.0);
+      }
+      block[count++] = acc[j] * fade;
+    }
+    if (!push(block.data(), count)) {
+      return;
+    }
+    memmove(acc.data(), acc.data() + hop, (nFFT - hop) * sizeof(double));
+    fill(acc.begin() + (nFFT - hop), acc.end(), 0.0);
+  }
+  lock_guard<mutex> lock(m_mutex);
+  m_done = true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "fft.hpp"
+
+using namespace std;
+
+// Plays a time-frequency rectangle of 16-bit samples. A worker thread runs
+// a Hann-windowed STFT over the selected time span, zeroes the bins outside
+// the band, and resynthesizes by weighted overlap-add, one hop at a time,
+// into a bounded ring that read() drains. Nothing is rendered beyond the
+// ring, so playback starts after the first hop whatever the length of the
+// selection. x must outlive the object.
+class Resynth {
+ public:
+  Resynth(const int16_t *x, int nSamples, int fs, double t0, double t1,
+          double f0, double f1, int nFFT = 2048);
+  Resynth(const Resynth &) = delete;
+  Resynth &operator=(const Resynth &) = delete;
+  ~Resynth();
+  // Copies up to n samples and returns how many; 0 while the worker is
+  // behind, or once finished().
+  int read(int16_t *out, int n);
+  // Everything has been rendered and read.
+  bool finished();
+
+ private:
+  void run();
+  bool push(const double *y, int n);
+  const int16_t *m_x;
+  int m_nSamples;
+  int m_fs;
+  int m_n0;
+  int m_n1;
+  double m_f0;
+  double m_f1;
+  int m_nFFT;
+  // Fade at both ends of the selection, in samples.
+  int m_nFade;
+  vector<int16_t> m_ring;
+  // Total samples written and read; the ring index is the count modulo its
+  // size.
+  long m_written = 0;
+  long m_read = 0;
+  bool m_done = false;
+  bool m_stop = false;
+  mutex m_mutex;
+  condition_variable m_space;
+  thread m_worker;
+};
@@ -0,0 +1,93 @@
+#include "sliceview.hpp"
+
+#include <QPainter>
+#include <QPainterPath>
+#include <algorithm>
+#include <cmath>
+
+#include "profiler.hpp"
+
+SliceView::SliceView(QWidget *parent) : QWidget(parent) {
+  setSizePolicy(QSizePolicy(QSizePolicy::Preferred, QSizePolicy::Fixed));
+  setMinimumHeight(120);
+}
+
+void SliceView::setSound(Sound *sound) {
+  m_sound = sound;
+  m_frame = -1;
+  update();
+}
+
+void SliceView::setFrame(int i) {
+  if (i == m_frame) {
+    return;
+  }
+  m_frame = i;
+  update();
+}
+
+void SliceView::refresh() { update(); }
+
+void SliceView::setRange(double lower_dB, double upper_dB) {
+  m_lower_dB = lower_dB;
+  m_upper_dB = upper_dB;
+  update();
+}
+
+void SliceView::paintEvent(QPaintEvent *e) {
+  (void)e;
+  PROFILE_SCOPE("Slice draw");
+  QPainter painter(this);
+  painter.fillRect(rect(), Qt::black);
+  if (!m_sound || m_frame < 0 || m_frame >= m_sound->nFrames() ||
+      !m_sound->frameReady(m_frame)) {
+    return;
+  }
+  int w = width();
+  int h = height();
+  int nBins = m_sound->nBins();
+  double range = m_upper_dB - m_lower_dB;
+  auto dB2y = [&](double dB) {
+    return h * min(max((m_upper_dB - dB) / range, 0.0), 1.0);
+  };
+  m_bin_dB.resize(nBins);
+  float lo;
+  float hi;
+  if (m_sound->specF()) {
+    power2dB(m_sound->specF()[m_frame], nBins, m_bin_dB.data(), &lo, &hi);
+  } else {
+    power2dB(m_sound->spec()[m_frame], nBins, m_bin_dB.data(), &lo, &hi);
+  }
+  // Each pixel column shows the loudest of its bins, so narrow peaks stay
+  // visible when there are more bins than pixels.
+  m_column_dB.resize(w);
+  for (int x = 0; x < w; x++) {
+    int k0 = (int)((double)x * nBins / w);
+    int k1 = max((int)((double)(x + 1) * nBins / w), k0 + 1);
+    float level = m_bin_dB[min(k0, nBins - 1)];
+    for (int k = k0 + 1; k < min(k1, nBins); k++) {
+      level = max(level, m_bin_dB[k]);
+    }
+    m_column_dB[x] = level;
+  }
+  QPainterPath path;
+  path.moveTo(0, dB2y(m_column_dB[0]));
+  for (int x = 1; x < w; x++) {
+    path.lineTo(x, dB2y(m_column_dB[x]));
+  }
+  painter.setPen(QColor(Qt::green));
+  painter.drawPath(path);
+  double k;
+  double peak_dB;
+  if (!m_sound->framePeak(m_frame, &k, &peak_dB) || !isfinite(peak_dB)) {
+    return;
+  }
+  double x = (k + 0.5) * w / nBins;
+  painter.setPen(QColor(Qt::red));
+  painter.drawLine(QPointF(x, dB2y(peak_dB)), QPointF(x, h));
+  painter.setPen(QColor(Qt::white));
+  painter.drawText(4, 14,
+                   QString("Peak %1 Hz, %2 dB")
+                       .arg(m_sound->binFreq(k), 0, 'f', 1)
+                       .arg(peak_dB, 0, 'f', 1));
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QWidget>
+#include <vector>
+
+#include "sound.hpp"
+
+using namespace std;
+
+// Magnitude spectrum of the frame under the cursor and its interpolated
+// peak. Everything is read from the stored spectrum of the last analysis,
+// so a refresh costs one pass over the bins of one frame whatever the
+// length of the file, and never runs a transform.
+class SliceView : public QWidget {
+ public:
+  SliceView(QWidget *parent = nullptr);
+  QSize sizeHint() const override { return QSize(240, 160); }
+  void setSound(Sound *sound);
+  // Frame of the last analysis to show; -1 clears the panel. Repeated calls
+  // for the same frame do nothing.
+  void setFrame(int i);
+  // The spectrum changed under the current frame index.
+  void refresh();
+  void setRange(double lower_dB, double upper_dB);
+
+ protected:
+  void paintEvent(QPaintEvent *e) override;
+
+ private:
+  Sound *m_sound = nullptr;
+  int m_frame = -1;
+  double m_lower_dB = -120.0;
+  double m_upper_dB = 0.0;
+  vector<float> m_bin_dB;
+  // Per-pixel maximum over the bins of each column.
+  vector<float> m_column_dB;
+};
@@ -4,6 +4,9 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <thread>
+
+#include "profiler.hpp"
 
 using namespace std;
 
@@ -13,6 +16,7 @@ Sound::Sound(string fname, int nMargin, Window::WindowType windowType) {
   int buf4;
   short buf2;
   int blockSize;
+  PROFILE_SCOPE("WAV parse");
   m_nMargin = nMargin;
   cerr << "Read file: " << fname << endl;
   fin.open(fname, ios::in | ios::binary);
@@ -60,57 +64,525 @@ Sound::Sound(string fname, int nMargin, Window::WindowType windowType) {
   m_nSamples = buf4 / blockSize;
   m_duration = (double)m_nSamples / m_fs;
   cerr << m_duration << " sec" << endl;
-  m_x = new double[m_nSamples + 2 * nMargin];
+  {
+    PROFILE_SCOPE("Sample conversion");
+    m_x.resize(m_nSamples + 2 * nMargin);
+    for (int n = 0; n < nMargin; n++) {
+      m_x[n] = 0.0;
+      m_x[m_nSamples + nMargin + n] = 0.0;
+    }
+    for (int n = nMargin; n < m_nSamples + nMargin; n++) {
+      fin.read((char *)&buf2, 2);
+      m_x[n] =
+          (double)(buf2 + (SHRT_MAX + 1.0) + 0.5) / (SHRT_MAX + 1.0) - 1.0;
+    }
+  }
+  Profiler::set(Profiler::SampleBytes, m_x.bytes());
+  fin.close();
+  m_fft.reset(new FFT(2048, windowType, m_fs));
+}
+
+void Sound::analyze(TFMethod method, int hopSize,
+                    Window::WindowType windowType, int windowSize) {
+  switch (method) {
+    case TFMethod::STFT:
+      stft(hopSize, windowType, windowSize);
+      break;
+    case TFMethod::Reassigned:
+      reassign(hopSize, windowType, windowSize);
+      break;
+    case TFMethod::ConstantQ:
+    case TFMethod::Wavelet:
+      cqt(method, hopSize);
+      break;
+    default:
+      cerr << "Unsupported analysis method." << endl;
+      cerr << "Force set to STFT." << endl;
+      stft(hopSize, windowType, windowSize);
+      break;
+  }
+}
+
+// The margin grows with the FFT size so every frame stays inside m_x.
+void Sound::setFFTSize(int nFFT) {
+  if (nFFT == m_fft->nFFT()) {
+    return;
+  }
+  m_fft.reset(new FFT(nFFT, Window::WindowType::Rect, m_fs));
+  m_fftF.reset();
+  ensureMargin(m_fft->nFFT() / 2);
+  m_spec.clear();
+  m_specF.clear();
+  m_features.clear();
+  m_nFrames = 0;
+  m_ready = nullptr;
+  m_nPending = 0;
+  m_arena.release();
+  m_scratch.clear();
+}
+
+void Sound::ensureMargin(int nMargin) {
+  if (nMargin <= m_nMargin) {
+    return;
+  }
+  AlignedBuffer<double> x(m_nSamples + 2 * nMargin);
   for (int n = 0; n < nMargin; n++) {
-    m_x[n] = 0.0;
-    m_x[m_nSamples + nMargin + n] = 0.0;
+    x[n] = 0.0;
+    x[m_nSamples + nMargin + n] = 0.0;
   }
-  for (int n = nMargin; n < m_nSamples + nMargin; n++) {
-    fin.read((char *)&buf2, 2);
-    m_x[n] = (double)(buf2 + (SHRT_MAX + 1.0) + 0.5) / (SHRT_MAX + 1.0) - 1.0;
+  for (int n = 0; n < m_nSamples; n++) {
+    x[nMargin + n] = m_x[m_nMargin + n];
   }
-  fin.close();
-  m_fft = new FFT(2048, windowType, m_fs);
+  m_x = move(x);
+  m_nMargin = nMargin;
+  Profiler::set(Profiler::SampleBytes, m_x.bytes());
 }
 
-Sound::~Sound() {
-  delete[] m_x;
-  delete m_fft;
+// Starts an analysis: everything the previous one put in m_arena is
+// recycled here, so this must come before any other arena allocation.
+void Sound::allocSpec(int nFrames, int nBins, bool single) {
+  m_arena.reset();
+  m_spec.clear();
+  m_specF.clear();
+  m_features.clear();
+  m_stftPrepared = false;
+  m_ready = nullptr;
+  m_nPending = 0;
+  m_nFrames = nFrames;
+  m_nBins = nBins;
+  m_binsPerOctave = 0;
+  m_fMin = 0.0;
+  if (single) {
+    m_specF.place(m_arena, nFrames, nBins);
+  } else {
+    m_spec.place(m_arena, nFrames, nBins);
+  }
+  Profiler::set(Profiler::SpecBytes, m_spec.bytes() + m_specF.bytes());
+}
+
+int Sound::threadCount(int nFrames) {
+  static const int minFramesPerThread = 16;
+  int nThreads = thread::hardware_concurrency();
+  return max(1, min(nThreads, nFrames / minFramesPerThread));
+}
+
+// One recycled scratch arena per worker thread, so threads never share an
+// allocator.
+Arena *Sound::scratchArenas(int nThreads) {
+  if ((int)m_scratch.size() < nThreads) {
+    m_scratch.resize(nThreads);
+  }
+  for (Arena &arena : m_scratch) {
+    arena.reset();
+  }
+  return m_scratch.data();
+}
+
+void Sound::finishLevels() {
+  m_specMax = pow(10.0, m_levels.max_dB / 20.0);
+  m_specMin = pow(10.0, m_levels.min_dB / 20.0);
 }
 
 void Sound::stft(int hopSize, Window::WindowType windowType, int windowSize) {
+  if (prepareSTFT(hopSize, windowType, windowSize)) {
+    computeFrames(0, m_nFrames);
+  }
+}
+
+bool Sound::prepareSTFT(int hopSize, Window::WindowType windowType,
+                        int windowSize) {
   int nFFT = m_fft->nFFT();
   if (m_nMargin < nFFT / 2) {
     cerr << "Too short nMargin: " << m_nMargin << ", nFFT: " << nFFT << endl;
+    return false;
+  }
+  m_hopSize = hopSize;
+  m_windowType = windowType;
+  m_windowSize = windowSize;
+  m_stftPrecision = m_precision;
+  switch (m_precision) {
+    case Precision::Single:
+      if (!m_fftF) {
+        m_fftF.reset(
+            new BasicFFT<float>(nFFT, Window::WindowType::Rect, m_fs));
+      }
+      allocSpec(m_nSamples / hopSize, nFFT / 2, true);
+      stftSetup(m_fftF.get());
+      break;
+    case Precision::Mixed:
+      allocSpec(m_nSamples / hopSize, nFFT / 2, true);
+      stftSetup(m_fft.get());
+      break;
+    default:
+      allocSpec(m_nSamples / hopSize, nFFT / 2);
+      stftSetup(m_fft.get());
+      break;
+  }
+  m_ready = m_arena.alloc<unsigned char>(m_nFrames);
+  fill(m_ready, m_ready + m_nFrames, 0);
+  m_nPending = m_nFrames;
+  m_stftPrepared = true;
+  resetLevels();
+  return true;
+}
+
+void Sound::updateFeatures() {
+  m_features.clear();
+  if (!m_stftPrepared || !m_features.anyEnabled()) {
     return;
   }
-  double *in = new double[nFFT];
-  complex<double> *out = new complex<double>[nFFT];
-  m_fft->setWindow(windowType, windowSize);
-  Window *window = m_fft->window();
-  double width = m_nSamples / hopSize;
-  m_spec = new complex<double> *[int(width)];
-  for (int i = 0; i < width; i++) {
-    m_spec[i] = new complex<double>[nFFT / 2];
-  }
-  m_specMax = 0.0;
-  m_specMin = 1.0;
-  for (int i = 0; i < m_nSamples / hopSize; i++) {
-    for (int n = -nFFT / 2; n < nFFT / 2; n++) {
-      in[n + nFFT / 2] =
-          m_x[i * hopSize + m_nMargin + n] * window->data()[n + nFFT / 2];
+  switch (m_stftPrecision) {
+    case Precision::Single:
+      featuresFromSpec(m_fftF.get(), m_specF.rows());
+      break;
+    case Precision::Mixed:
+      featuresFromSpec(m_fft.get(), m_specF.rows());
+      break;
+    default:
+      featuresFromSpec(m_fft.get(), m_spec.rows());
+      break;
+  }
+}
+
+// Frames still missing get their features when they are transformed.
+template <typename T, typename S>
+void Sound::featuresFromSpec(BasicFFT<T> *fft, complex<S> **spec) {
+  PROFILE_SCOPE("Features");
+  stftSetup(fft);
+  Arena &scratch = scratchArenas(1)[0];
+  double *pow = scratch.alloc<double>(m_nBins);
+  double *prevMag = scratch.alloc<double>(m_nBins);
+  for (int i = 0; i < m_nFrames; i++) {
+    if (frameReady(i)) {
+      m_features.frame(i, spec[i], pow, prevMag, i > 0 && frameReady(i - 1));
     }
-    m_fft->exec(in, out);
-    for (int k = 0; k < nFFT / 2; k++) {
-      m_spec[i][k] = out[k];
-      if (abs(m_spec[i][k]) > m_specMax) {
-        m_specMax = abs(m_spec[i][k]);
+  }
+}
+
+template <typename T>
+void Sound::stftSetup(BasicFFT<T> *fft) {
+  fft->setWindow(m_windowType, m_windowSize);
+  if (m_features.anyEnabled()) {
+    m_features.configure(fft, m_fs);
+    m_features.begin(m_nFrames);
+    m_features.invalidate();
+  }
+}
+
+int Sound::computeFrames(int i0, int i1) {
+  if (!m_ready) {
+    return 0;
+  }
+  PROFILE_SCOPE("STFT");
+  i0 = max(i0, 0);
+  i1 = min(i1, m_nFrames);
+  int nComputed = 0;
+  while (i0 < i1) {
+    if (m_ready[i0]) {
+      i0++;
+      continue;
+    }
+    int end = i0;
+    while (end < i1 && !m_ready[end]) {
+      end++;
+    }
+    switch (m_stftPrecision) {
+      case Precision::Single:
+        stftRange(i0, end, m_fftF.get(), m_specF.rows());
+        break;
+      case Precision::Mixed:
+        stftRange(i0, end, m_fft.get(), m_specF.rows());
+        break;
+      default:
+        stftRange(i0, end, m_fft.get(), m_spec.rows());
+        break;
+    }
+    nComputed += end - i0;
+    i0 = end;
+  }
+  if (nComputed) {
+    m_nPending -= nComputed;
+    finishLevels();
+  }
+  return nComputed;
+}
+
+// Frames i0 .. i1 - 1, none of them computed yet. T is the arithmetic
+// type, S the storage type. The frames are split into contiguous runs, one
+// per thread, each with its own buffers and levels. The window is set
+// again because the FFT is shared with streamSTFT().
+template <typename T, typename S>
+void Sound::stftRange(int i0, int i1, BasicFFT<T> *fft, complex<S> **spec) {
+  int nFFT = fft->nFFT();
+  int nBins = nFFT / 2;
+  int hopSize = m_hopSize;
+  fft->setWindow(m_windowType, m_windowSize);
+  bool features = m_features.anyEnabled();
+  int nFrames = i1 - i0;
+  int nThreads = threadCount(nFrames);
+  Arena *scratch = scratchArenas(nThreads);
+  Levels *levels = scratch[0].alloc<Levels>(nThreads);
+  vector<thread> workers;
+  for (int t = 0; t < nThreads; t++) {
+    workers.emplace_back([&, t]() {
+      T *work = scratch[t].alloc<T>(2 * BasicFFT<T>::batchFrames * nFFT);
+      complex<T> *out =
+          scratch[t].alloc<complex<T>>(BasicFFT<T>::batchFrames * nBins);
+      double *pow = features ? scratch[t].alloc<double>(nBins) : nullptr;
+      double *prevMag = features ? scratch[t].alloc<double>(nBins) : nullptr;
+      float *dB = scratch[t].alloc<float>(nBins);
+      Levels &level = levels[t];
+      level.reset();
+      int begin = i0 + (long)nFrames * t / nThreads;
+      int end = i0 + (long)nFrames * (t + 1) / nThreads;
+      stftFrames(begin, end, hopSize, fft, work, out,
+                 [&](int i, const complex<T> *X) {
+                   for (int k = 0; k < nBins; k++) {
+                     spec[i][k] = complex<S>(X[k]);
+                   }
+                   float lo;
+                   float hi;
+                   power2dB(X, nBins, dB, &lo, &hi);
+                   level.addRow(dB, nBins, lo, hi);
+                   if (features) {
+                     m_features.frame(i, X, pow, prevMag, i > begin);
+                   }
+                 });
+    });
+  }
+  for (thread &worker : workers) {
+    worker.join();
+  }
+  fill(m_ready + i0, m_ready + i1, 1);
+  // Flux needs the previous frame, which a thread did not have at the start
+  // of its run, and the frame after this range may have been waiting for
+  // this one.
+  for (int t = 0; features && t <= nThreads; t++) {
+    int i = t < nThreads ? i0 + (long)nFrames * t / nThreads : i1;
+    if (i > 0 && i < m_nFrames && m_ready[i - 1] && m_ready[i]) {
+      m_features.fixFlux(i, spec[i - 1], spec[i]);
+    }
+  }
+  for (int t = 0; t < nThreads; t++) {
+    m_levels.merge(levels[t]);
+  }
+}
+
+// Frames i0 .. i1 - 1 with the window already set on fft, batchFrames at a
+// time through execFrames(); work holds 2 batchFrames nFFT values and out
+// batchFrames nFFT / 2 bins.
+template <typename T, typename F>
+void Sound::stftFrames(int i0, int i1, int hopSize, BasicFFT<T> *fft, T *work,
+                       complex<T> *out, F &&frame) {
+  int nFFT = fft->nFFT();
+  int nBins = nFFT / 2;
+  for (int i = i0; i < i1; i += BasicFFT<T>::batchFrames) {
+    int n = min(BasicFFT<T>::batchFrames, i1 - i);
+    const double *x = m_x.data() + (long)i * hopSize + m_nMargin - nFFT / 2;
+    fft->execFrames(x, hopSize, n, nBins, out, work);
+    for (int f = 0; f < n; f++) {
+      frame(i + f, out + (long)f * nBins);
+    }
+  }
+}
+
+void Sound::streamSTFT(
+    int hopSize, Window::WindowType windowType, int windowSize,
+    const function<void(int, const complex<double> *)> &frame) {
+  PROFILE_SCOPE("STFT stream");
+  int nFFT = m_fft->nFFT();
+  if (m_nMargin < nFFT / 2) {
+    cerr << "Too short nMargin: " << m_nMargin << ", nFFT: " << nFFT << endl;
+    return;
+  }
+  m_fft->setWindow(windowType, windowSize);
+  Arena &scratch = scratchArenas(1)[0];
+  double *work = scratch.alloc<double>(2 * FFT::batchFrames * nFFT);
+  complex<double> *out =
+      scratch.alloc<complex<double>>(FFT::batchFrames * nFFT / 2);
+  stftFrames(0, m_nSamples / hopSize, hopSize, m_fft.get(), work, out, frame);
+}
+
+// Time-frequency reassignment (Auger & Flandrin). Besides the analysis
+// window h, each frame is transformed with its derivative Dh and the
+// time-weighted window Th, and the energy of every bin is moved to its
+// centre of gravity:
+//   t^ = t + Re(X_Th / X_h),  w^ = w - Im(X_Dh / X_h).
+// h is the effective window of stft(), which applies the window twice.
+// Frames are split across threads; each thread scatters into its own slab
+// of the grid, widened by the largest possible time shift, and the slabs
+// are summed afterwards.
+void Sound::reassign(int hopSize, Window::WindowType windowType,
+                     int windowSize) {
+  PROFILE_SCOPE("Reassignment");
+  int nFFT = m_fft->nFFT();
+  int nBins = nFFT / 2;
+  if (m_nMargin < nFFT / 2) {
+    cerr << "Too short nMargin: " << m_nMargin << ", nFFT: " << nFFT << endl;
+    return;
+  }
+  allocSpec(m_nSamples / hopSize, nBins);
+  m_fft->setWindow(windowType, windowSize);
+  const double *w = m_fft->window()->data();
+  double area = m_fft->window()->area();
+  double *h = m_arena.alloc<double>(nFFT);
+  double *dh = m_arena.alloc<double>(nFFT);
+  double *th = m_arena.alloc<double>(nFFT);
+  for (int n = 0; n < nFFT; n++) {
+    h[n] = w[n] * w[n];
+  }
+  for (int n = 0; n < nFFT; n++) {
+    double prev = n > 0 ? h[n - 1] : 0.0;
+    double next = n < nFFT - 1 ? h[n + 1] : 0.0;
+    dh[n] = (next - prev) / 2.0;
+    th[n] = (n - nFFT / 2) * h[n];
+  }
+  int spill = nFFT / 2 / hopSize + 1;
+  int nThreads = threadCount(m_nFrames);
+  Arena *scratch = scratchArenas(nThreads);
+  double **grids = m_arena.alloc<double *>(nThreads);
+  int *gridRows = m_arena.alloc<int>(nThreads);
+  vector<thread> workers;
+  for (int t = 0; t < nThreads; t++) {
+    workers.emplace_back([&, t]() {
+      int i0 = (long)m_nFrames * t / nThreads;
+      int i1 = (long)m_nFrames * (t + 1) / nThreads;
+      int base = max(i0 - spill, 0);
+      int top = min(i1 + spill, m_nFrames);
+      gridRows[t] = top - base;
+      double *grid = scratch[t].alloc<double>((size_t)gridRows[t] * nBins);
+      fill(grid, grid + (size_t)gridRows[t] * nBins, 0.0);
+      grids[t] = grid;
+      double *in = scratch[t].alloc<double>(nFFT);
+      complex<double> *xh = scratch[t].alloc<complex<double>>(nFFT);
+      complex<double> *xdh = scratch[t].alloc<complex<double>>(nFFT);
+      complex<double> *xth = scratch[t].alloc<complex<double>>(nFFT);
+      for (int i = i0; i < i1; i++) {
+        const double *x = m_x.data() + i * hopSize + m_nMargin - nFFT / 2;
+        for (int n = 0; n < nFFT; n++) {
+          in[n] = x[n] * h[n];
+        }
+        m_fft->transform(in, xh);
+        for (int n = 0; n < nFFT; n++) {
+          in[n] = x[n] * dh[n];
+        }
+        m_fft->transform(in, xdh);
+        for (int n = 0; n < nFFT; n++) {
+          in[n] = x[n] * th[n];
+        }
+        m_fft->transform(in, xth);
+        for (int k = 0; k < nBins; k++) {
+          double p = norm(xh[k]);
+          if (p == 0.0) {
+            continue;
+          }
+          complex<double> inv = conj(xh[k]) / p;
+          double iHat = i + real(xth[k] * inv) / hopSize;
+          double kHat = k - nFFT / (2.0 * M_PI) * imag(xdh[k] * inv);
+          // Also rejects NaN.
+          if (!(iHat >= base - 0.5 && iHat < top - 0.5 && kHat >= -0.5 &&
+                kHat < nBins - 0.5)) {
+            continue;
+          }
+          int ii = (int)(iHat + 0.5);
+          int kk = (int)(kHat + 0.5);
+          grid[(size_t)(ii - base) * nBins + kk] += p / (area * area);
+        }
       }
-      if (abs(m_spec[i][k]) < m_specMin) {
-        m_specMin = abs(m_spec[i][k]);
+    });
+  }
+  for (thread &worker : workers) {
+    worker.join();
+  }
+  m_spec.fill(0.0);
+  for (int t = 0; t < nThreads; t++) {
+    int base = max((int)((long)m_nFrames * t / nThreads) - spill, 0);
+    for (int i = 0; i < gridRows[t]; i++) {
+      for (int k = 0; k < nBins; k++) {
+        m_spec[base + i][k] += grids[t][(size_t)i * nBins + k];
       }
     }
   }
-  delete[] in;
-  delete[] out;
+  resetLevels();
+  for (int i = 0; i < m_nFrames; i++) {
+    for (int k = 0; k < nBins; k++) {
+      addLevel(real(m_spec[i][k]));
+      m_spec[i][k] = sqrt(real(m_spec[i][k]));
+    }
+  }
+  finishLevels();
+}
+
+// Window type and size do not apply: the kernel length follows the bin
+// frequency.
+void Sound::cqt(TFMethod method, int hopSize) {
+  PROFILE_SCOPE(method == TFMethod::Wavelet ? "Wavelet" : "Constant-Q");
+  CQT::Kernel kernel = method == TFMethod::Wavelet ? CQT::Kernel::Morlet
+                                                  : CQT::Kernel::Hann;
+  if (!m_cqt || m_cqt->kernel() != kernel) {
+    m_cqt.reset(new CQT(m_fs, 27.5, 48, kernel));
+  }
+  allocSpec(m_nSamples / hopSize, m_cqt->nBins());
+  m_binsPerOctave = m_cqt->binsPerOctave();
+  m_fMin = m_cqt->fMin();
+  m_cqt->exec(m_x.data() + m_nMargin, m_nSamples, hopSize, m_nFrames,
+              m_spec.rows());
+  float *dB = scratchArenas(1)->alloc<float>(m_nBins);
+  float lo;
+  float hi;
+  resetLevels();
+  for (int i = 0; i < m_nFrames; i++) {
+    power2dB(m_spec[i], m_nBins, dB, &lo, &hi);
+    m_levels.addRow(dB, m_nBins, lo, hi);
+  }
+  finishLevels();
+}
+
+bool Sound::framePeak(int i, double *k, double *peak_dB) {
+  if (i < 0 || i >= m_nFrames || m_nBins < 1 || !frameReady(i)) {
+    return false;
+  }
+  int kMax = 0;
+  double powMax = -1.0;
+  for (int j = 0; j < m_nBins; j++) {
+    double p = m_specF.empty() ? norm(m_spec[i][j]) : norm(m_specF[i][j]);
+    if (p > powMax) {
+      powMax = p;
+      kMax = j;
+    }
+  }
+  double b = level_dB(i, kMax);
+  double delta = 0.0;
+  double level = b;
+  if (kMax > 0 && kMax < m_nBins - 1) {
+    double a = level_dB(i, kMax - 1);
+    double c = level_dB(i, kMax + 1);
+    double curv = a - 2.0 * b + c;
+    if (isfinite(curv) && curv < 0.0) {
+      delta = 0.5 * (a - c) / curv;
+      level = b - 0.25 * (a - c) * delta;
+    }
+  }
+  *k = kMax + delta;
+  *peak_dB = level;
+  return true;
+}
+
+double Sound::specPercentile(double p) {
+  long total = 0;
+  for (long n : m_levels.hist) {
+    total += n;
+  }
+  if (!total) {
+    return histMin_dB;
+  }
+  long target = p * total;
+  long count = 0;
+  for (int h = 0; h < nHistBins; h++) {
+    count += m_levels.hist[h];
+    if (count > target) {
+      return histMin_dB + (h + 0.5) * histStep_dB;
+    }
+  }
+  return histMin_dB + nHistBins * histStep_dB;
 }
@@ -1,36 +1,192 @@
 #pragma once
 
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "buffer.hpp"
+#include "cqt.hpp"
+#include "decibel.hpp"
+#include "features.hpp"
 #include "fft.hpp"
 
 using namespace std;
 
+// Owns the samples, the transforms and the spectrum of the last analysis.
+// Move-only. Every buffer of an analysis comes from m_arena, or from one
+// scratch arena per worker thread, and is recycled in one step by the next
+// analysis; changing the FFT size returns the memory.
 class Sound {
  public:
+  enum TFMethod { STFT, Reassigned, ConstantQ, Wavelet, NumTFMethod };
+  // STFT arithmetic and spectrum storage. Mixed keeps the double FFT and
+  // stores float, which only adds the storage rounding (about -144 dB
+  // relative). Single also runs the FFT in float; see BasicFFT for its
+  // error. Reassignment and constant-Q always run and store in double.
+  enum Precision { Double, Single, Mixed, NumPrecision };
   Sound(string fname, int nMargin = 1024,
         Window::WindowType windowType = Window::WindowType::Gaussian);
-  ~Sound();
+  Sound(const Sound &) = delete;
+  Sound &operator=(const Sound &) = delete;
+  Sound(Sound &&) = default;
+  Sound &operator=(Sound &&) = default;
+  // False when the file could not be read.
+  bool loaded() { return (bool)m_fft; }
+  // Takes over the arenas of a sound that is done with them, so a sequence
+  // of analyses only grows them when a file is longer than before.
+  void reuseBuffers(Sound &other) {
+    m_arena = move(other.m_arena);
+    m_scratch = move(other.m_scratch);
+    other.m_spec.clear();
+    other.m_specF.clear();
+    other.m_nFrames = 0;
+    other.m_ready = nullptr;
+    other.m_nPending = 0;
+  }
   int fs() { return m_fs; }
   int nSamples() { return m_nSamples; }
   double duration() { return m_duration; }
   int nMargin() { return m_nMargin; }
-  double *x() { return m_x; }
-  FFT *fft() { return m_fft; }
-  complex<double> **spec() { return m_spec; }
+  double *x() { return m_x.data(); }
+  FFT *fft() { return m_fft.get(); }
+  void setFFTSize(int nFFT);
+  int nFrames() { return m_nFrames; }
+  int nBins() { return m_nBins; }
+  // Bins of the last analysis are linear up to fs / 2 unless
+  // binsPerOctave() is nonzero; then bin k is at fMin() * 2^(k / B).
+  int binsPerOctave() { return m_binsPerOctave; }
+  double fMin() { return m_fMin; }
+  void setPrecision(Precision precision) { m_precision = precision; }
+  // Exactly one of spec() and specF() is non-null after an analysis.
+  complex<double> **spec() { return m_spec.rows(); }
+  complex<float> **specF() { return m_specF.rows(); }
+  // Filled by the STFT, in the same pass, when any feature is enabled;
+  // empty after other methods. None is enabled by default; after changing
+  // the selection, updateFeatures() fills the frames of the current STFT
+  // that are already computed from the stored spectrum.
+  Features *features() { return &m_features; }
+  void updateFeatures();
   double specMax() { return m_specMax; }
   double specMin() { return m_specMin; }
+  double specPercentile(double p);
+  // Centre frequency of a fractional bin position of the last analysis.
+  double binFreq(double k) {
+    return m_binsPerOctave ? m_fMin * pow(2.0, k / m_binsPerOctave)
+                           : k * m_fs / 2.0 / m_nBins;
+  }
+  // Level of bin k of frame i in dB; -inf for an empty bin.
+  double level_dB(int i, int k) {
+    return 20.0 * log10(m_specF.empty() ? abs(m_spec[i][k])
+                                        : (double)abs(m_specF[i][k]));
+  }
+  // Strongest bin of frame i as a fractional bin position, refined by a
+  // parabola through the dB levels of it and its neighbours; binFreq(*k)
+  // is its frequency. Reads the stored spectrum only; false when frame i is
+  // out of range or not computed.
+  bool framePeak(int i, double *k, double *peak_dB);
+  void analyze(TFMethod method, int hopSize, Window::WindowType windowType,
+               int windowSize);
   void stft(int hopSize, Window::WindowType windowType, int windowSize);
+  // Lazy STFT. prepareSTFT() sets up the spectrum of an STFT without
+  // transforming any frame; computeFrames() fills the frames of [i0, i1)
+  // that are still missing and returns how many it computed, so no frame is
+  // transformed twice. Levels and features cover the computed frames.
+  bool prepareSTFT(int hopSize, Window::WindowType windowType,
+                   int windowSize);
+  int computeFrames(int i0, int i1);
+  bool frameReady(int i) { return !m_ready || m_ready[i]; }
+  int nPending() { return m_nPending; }
+  void reassign(int hopSize, Window::WindowType windowType, int windowSize);
+  void cqt(TFMethod method, int hopSize);
+  // Runs the double precision STFT without storing it: frame(i, X) gets
+  // the nFFT / 2 bins of frame i, in order, and X is only valid during the
+  // call. Leaves the last analysis untouched.
+  void streamSTFT(int hopSize, Window::WindowType windowType, int windowSize,
+                  const function<void(int, const complex<double> *)> &frame);
 
  private:
-  int m_fs;
-  int m_nSamples;
-  int m_nChannels;
-  double m_duration;
-  int m_nMargin;
-  double *m_x;
-  FFT *m_fft;
-  complex<double> **m_spec;
-  double m_specMax;
-  double m_specMin;
+  void allocSpec(int nFrames, int nBins, bool single = false);
+  template <typename T>
+  void stftSetup(BasicFFT<T> *fft);
+  template <typename T, typename S>
+  void featuresFromSpec(BasicFFT<T> *fft, complex<S> **spec);
+  template <typename T, typename S>
+  void stftRange(int i0, int i1, BasicFFT<T> *fft, complex<S> **spec);
+  template <typename T, typename F>
+  void stftFrames(int i0, int i1, int hopSize, BasicFFT<T> *fft, T *work,
+                  complex<T> *out, F &&frame);
+  void ensureMargin(int nMargin);
+  static int threadCount(int nFrames);
+  Arena *scratchArenas(int nThreads);
+  // Level histogram of an analysis, used for robust auto-ranging. Threads
+  // fill their own and merge them.
+  static constexpr double histMin_dB = -240.0;
+  static constexpr double histStep_dB = 0.5;
+  static constexpr int nHistBins = 640;
+  struct Levels {
+    float max_dB;
+    float min_dB;
+    long hist[nHistBins];
+    void reset() {
+      max_dB = -HUGE_VALF;
+      min_dB = 0.0f;
+      fill(hist, hist + nHistBins, 0);
+    }
+    void add(double p) {
+      float dB = power2dB((float)p);
+      addRow(&dB, 1, dB, dB);
+    }
+    // n levels from power2dB with their range.
+    void addRow(const float *dB, int n, float lo, float hi) {
+      max_dB = max(max_dB, hi);
+      min_dB = min(min_dB, lo);
+      for (int k = 0; k < n; k++) {
+        float h = (dB[k] - (float)histMin_dB) / (float)histStep_dB;
+        hist[(int)min(max(h, 0.0f), nHistBins - 1.0f)]++;
+      }
+    }
+    void merge(const Levels &other) {
+      max_dB = max(max_dB, other.max_dB);
+      min_dB = min(min_dB, other.min_dB);
+      for (int h = 0; h < nHistBins; h++) {
+        hist[h] += other.hist[h];
+      }
+    }
+  };
+  void resetLevels() { m_levels.reset(); }
+  void addLevel(double p) { m_levels.add(p); }
+  void finishLevels();
+  int m_fs = 0;
+  int m_nSamples = 0;
+  int m_nChannels = 0;
+  double m_duration = 0.0;
+  int m_nMargin = 0;
+  AlignedBuffer<double> m_x;
+  unique_ptr<FFT> m_fft;
+  unique_ptr<BasicFFT<float>> m_fftF;
+  Precision m_precision = Double;
+  int m_nFrames = 0;
+  int m_nBins = 0;
+  int m_binsPerOctave = 0;
+  double m_fMin = 0.0;
+  unique_ptr<CQT> m_cqt;
+  // The prepared STFT. m_ready flags its computed frames; null when every
+  // frame of the last analysis is there.
+  int m_hopSize = 0;
+  Window::WindowType m_windowType = Window::Hann;
+  int m_windowSize = 0;
+  Precision m_stftPrecision = Double;
+  // The spectrum is that of the prepared STFT.
+  bool m_stftPrepared = false;
+  unsigned char *m_ready = nullptr;
+  int m_nPending = 0;
+  Arena m_arena;
+  vector<Arena> m_scratch;
+  Matrix<complex<double>> m_spec;
+  Matrix<complex<float>> m_specF;
+  Features m_features;
+  double m_specMax = 0.0;
+  double m_specMin = 0.0;
+  Levels m_levels = {};
 };
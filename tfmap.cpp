@@ -0,0 +1,395 @@
+#include "tfmap.hpp"
+
+#include <QDebug>
+#include <QMatrix4x4>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLPixelTransferOptions>
+#include <QVector2D>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "mainwindow.hpp"
+#include "mel.hpp"
+#include "profiler.hpp"
+
+using namespace std;
+
+static const char *vertexShaderSource =
+    "attribute vec2 vertex;\n"
+    "uniform mat4 mvp;\n"
+    "uniform vec2 size;\n"
+    "varying vec2 texCoord;\n"
+    "void main() {\n"
+    "  texCoord = vec2(vertex.x / size.x, 1.0 - vertex.y / size.y);\n"
+    "  gl_Position = mvp * vec4(vertex, 0.0, 1.0);\n"
+    "}\n";
+
+// Same mapping as TFMapItem::freqFraction. freqScale follows the order of
+// TFScene::FreqScale.
+static const char *fragmentShaderSource =
+    "#ifdef GL_ES\n"
+    "precision highp float;\n"
+    "#endif\n"
+    "uniform sampler2D magTex;\n"
+    "uniform sampler2D lutTex;\n"
+    "uniform float lowerDB;\n"
+    "uniform float upperDB;\n"
+    "uniform float gamma;\n"
+    "uniform int freqScale;\n"
+    "uniform float nBins;\n"
+    "uniform float fsHalf;\n"
+    "uniform float scaleHi;\n"
+    "uniform float binsPerOctave;\n"
+    "uniform float fMin;\n"
+    "varying vec2 texCoord;\n"
+    "float erb2hz(float erb) {\n"
+    "  return (pow(10.0, erb / 21.3) - 1.0) / 0.00437;\n"
+    "}\n"
+    "float bark2hz(float bark) {\n"
+    "  float barkNew = bark;\n"
+    "  if (bark < 2.0) {\n"
+    "    barkNew = (bark - 0.3) / 0.85;\n"
+    "  } else if (bark > 20.1) {\n"
+    "    barkNew = (bark + 4.422) / 1.22;\n"
+    "  }\n"
+    "  return 1960.0 * (barkNew + 0.53) / (26.28 - barkNew);\n"
+    "}\n"
+    "float mel2hz(float mel) {\n"
+    "  return 700.0 * (pow(10.0, mel / 2595.0) - 1.0);\n"
+    "}\n"
+    "float freqFraction(float v) {\n"
+    "  if (freqScale == 1) {\n"
+    "    return (pow(nBins, v) - 1.0) / nBins;\n"
+    "  } else if (freqScale == 2) {\n"
+    "    return erb2hz(v * scaleHi) / fsHalf;\n"
+    "  } else if (freqScale == 3) {\n"
+    "    return bark2hz(v * scaleHi) / fsHalf;\n"
+    "  } else if (freqScale == 4) {\n"
+    "    return mel2hz(v * scaleHi) / fsHalf;\n"
+    "  }\n"
+    "  return v;\n"
+    "}\n"
+    "void main() {\n"
+    "  float f = clamp(freqFraction(texCoord.y), 0.0, 1.0);\n"
+    "  if (binsPerOctave > 0.0) {\n"
+    "    f = (binsPerOctave * log2(max(f * fsHalf, 1.0) / fMin) + 0.5) / "
+    "nBins;\n"
+    "  }\n"
+    "  float dB = texture2D(magTex, vec2(texCoord.x, f)).r;\n"
+    "  float x = clamp((dB - lowerDB) / (upperDB - lowerDB), 0.0, 1.0);\n"
+    "  x = pow(x, gamma);\n"
+    "  gl_FragColor = texture2D(lutTex, vec2((x * 255.0 + 0.5) / 256.0, "
+    "0.5));\n"
+    "}\n";
+
+TFMapItem::TFMapItem(int w, int h) {
+  m_w = w;
+  m_h = h;
+  m_lut = QImage(256, 1, QImage::Format_RGB888);
+  for (int i = 0; i < 256; i++) {
+    unsigned char *p = m_lut.scanLine(0) + i * 3;
+    TFScene::double2rgb(i / 255.0, p, p + 1, p + 2);
+  }
+}
+
+TFMapItem::~TFMapItem() { releaseGL(); }
+
+void TFMapItem::releaseGL() {
+  if (m_glWidget) {
+    m_glWidget->makeCurrent();
+  }
+  delete m_magTex;
+  delete m_lutTex;
+  delete m_program;
+  m_magTex = nullptr;
+  m_lutTex = nullptr;
+  m_program = nullptr;
+  if (m_glWidget) {
+    m_glWidget->doneCurrent();
+  }
+}
+
+// Upper end of the warped frequency axis, in its own unit.
+static double scaleHi(int type, double fs) {
+  switch ((TFScene::FreqScale)type) {
+    case TFScene::ERB:
+      return TFScene::hz2erb(fs / 2.0);
+    case TFScene::Bark:
+      return TFScene::hz2bark(fs / 2.0);
+    case TFScene::Mel:
+      return hz2mel(fs / 2.0);
+    default:
+      return 1.0;
+  }
+}
+
+double TFMapItem::freqFraction(int type, double v, double fs, int nBins) {
+  double hi = scaleHi(type, fs);
+  switch ((TFScene::FreqScale)type) {
+    case TFScene::Log:
+      return (pow(nBins, v) - 1.0) / nBins;
+    case TFScene::ERB:
+      return TFScene::erb2hz(v * hi) / (fs / 2.0);
+    case TFScene::Bark:
+      return TFScene::bark2hz(v * hi) / (fs / 2.0);
+    case TFScene::Mel:
+      return mel2hz(v * hi) / (fs / 2.0);
+    default:
+      return v;
+  }
+}
+
+float *TFMapItem::resizeMagnitude(int nFrames, int nBins) {
+  m_nFrames = nFrames;
+  m_nBins = nBins;
+  m_dB.resize((size_t)nFrames * nBins);
+  m_textureDirty.add(0, nFrames);
+  m_quantDirty.add(0, nFrames);
+  m_imageDirty = true;
+  update();
+  return m_dB.data();
+}
+
+void TFMapItem::magnitudeChanged(int i0, int i1) {
+  m_textureDirty.add(i0, i1);
+  m_quantDirty.add(i0, i1);
+  update();
+}
+
+void TFMapItem::setRange(double lower_dB, double upper_dB) {
+  if (lower_dB == m_lower_dB && upper_dB == m_upper_dB) {
+    return;
+  }
+  m_lower_dB = lower_dB;
+  m_upper_dB = upper_dB;
+  m_remapDirty = true;
+  update();
+}
+
+void TFMapItem::setGamma(double gamma) {
+  if (gamma == m_gamma) {
+    return;
+  }
+  m_gamma = gamma;
+  m_remapDirty = true;
+  update();
+}
+
+void TFMapItem::setFreqScale(int type, double fs) {
+  m_freqScale = type;
+  m_fs = fs;
+  m_imageDirty = true;
+  update();
+}
+
+void TFMapItem::setBinAxis(double fMin, int binsPerOctave) {
+  m_fMin = fMin;
+  m_binsPerOctave = binsPerOctave;
+  m_imageDirty = true;
+  update();
+}
+
+void TFMapItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+                      QWidget *widget) {
+  Q_UNUSED(option);
+  if (m_dB.empty()) {
+    return;
+  }
+  QOpenGLWidget *glWidget = qobject_cast<QOpenGLWidget *>(widget);
+  if (!m_glWidget) {
+    m_glWidget = glWidget;
+  }
+  if (glWidget && glWidget == m_glWidget && !m_glFailed &&
+      QOpenGLContext::currentContext()) {
+    painter->beginNativePainting();
+    if (initGL()) {
+      paintGL(painter);
+    }
+    painter->endNativePainting();
+    if (!m_glFailed) {
+      return;
+    }
+  }
+  paintSoftware(painter);
+}
+
+bool TFMapItem::initGL() {
+  if (m_program) {
+    return true;
+  }
+  if (!QOpenGLTexture::hasFeature(QOpenGLTexture::TextureRGFormats)) {
+    qDebug() << "Float textures are not supported, use software rendering.";
+    m_glFailed = true;
+    return false;
+  }
+  m_program = new QOpenGLShaderProgram();
+  m_program->addShaderFromSourceCode(QOpenGLShader::Vertex,
+                                     vertexShaderSource);
+  m_program->addShaderFromSourceCode(QOpenGLShader::Fragment,
+                                     fragmentShaderSource);
+  m_program->bindAttributeLocation("vertex", 0);
+  if (!m_program->link()) {
+    qDebug() << "Cannot link shader program:" << m_program->log();
+    delete m_program;
+    m_program = nullptr;
+    m_glFailed = true;
+    return false;
+  }
+  m_lutTex = new QOpenGLTexture(m_lut, QOpenGLTexture::DontGenerateMipMaps);
+  m_lutTex->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+  m_lutTex->setWrapMode(QOpenGLTexture::ClampToEdge);
+  m_textureDirty.add(0, m_nFrames);
+  return true;
+}
+
+void TFMapItem::uploadTexture() {
+  PROFILE_SCOPE("Texture upload");
+  QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+  GLint maxSize = 0;
+  f->glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+  int frameStep = (m_nFrames + maxSize - 1) / maxSize;
+  int binStep = (m_nBins + maxSize - 1) / maxSize;
+  int texW = m_nFrames / frameStep;
+  int texH = m_nBins / binStep;
+  bool resized =
+      !m_magTex || m_magTex->width() != texW || m_magTex->height() != texH;
+  // Texture columns c0 .. c1 - 1 hold the rewritten frames.
+  int c0 = resized ? 0 : m_textureDirty.begin / frameStep;
+  int c1 = resized ? texW
+                   : min((m_textureDirty.end + frameStep - 1) / frameStep,
+                         texW);
+  const float *src = m_dB.data();
+  if (frameStep > 1 || binStep > 1) {
+    // Keep peaks visible when the data exceeds the texture size limit.
+    m_pooled.resize((size_t)texW * texH);
+    for (int k = 0; k < texH; k++) {
+      fill(m_pooled.begin() + (size_t)k * texW + c0,
+           m_pooled.begin() + (size_t)k * texW + c1, -HUGE_VALF);
+    }
+    for (int k = 0; k < texH * binStep; k++) {
+      for (int i = c0 * frameStep; i < c1 * frameStep; i++) {
+        float &dst = m_pooled[(size_t)(k / binStep) * texW + i / frameStep];
+        dst = max(dst, m_dB[(size_t)k * m_nFrames + i]);
+      }
+    }
+    src = m_pooled.data();
+  }
+  if (resized) {
+    delete m_magTex;
+    m_magTex = new QOpenGLTexture(QOpenGLTexture::Target2D);
+    m_magTex->setFormat(QOpenGLTexture::R32F);
+    m_magTex->setSize(texW, texH);
+    m_magTex->setMipLevels(1);
+    m_magTex->allocateStorage(QOpenGLTexture::Red, QOpenGLTexture::Float32);
+    m_magTex->setMinMagFilters(QOpenGLTexture::Nearest,
+                               QOpenGLTexture::Nearest);
+    m_magTex->setWrapMode(QOpenGLTexture::ClampToEdge);
+  }
+  if (c1 > c0) {
+    QOpenGLPixelTransferOptions options;
+    options.setRowLength(texW);
+    m_magTex->setData(c0, 0, 0, c1 - c0, texH, 1, QOpenGLTexture::Red,
+                      QOpenGLTexture::Float32, src + c0, &options);
+  }
+  Profiler::set(Profiler::TextureBytes, (long)texW * texH * sizeof(float));
+  m_textureDirty.clear();
+}
+
+void TFMapItem::paintGL(QPainter *painter) {
+  QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+  if (!m_textureDirty.empty()) {
+    uploadTexture();
+  }
+  QMatrix4x4 proj;
+  proj.ortho(0, m_glWidget->width(), m_glWidget->height(), 0, -1.0, 1.0);
+  QMatrix4x4 mvp = proj * QMatrix4x4(painter->combinedTransform());
+  const GLfloat vertices[] = {0.0f, 0.0f,          (GLfloat)m_w, 0.0f,
+                              0.0f, (GLfloat)m_h,  (GLfloat)m_w, (GLfloat)m_h};
+  f->glDisable(GL_BLEND);
+  f->glBindBuffer(GL_ARRAY_BUFFER, 0);
+  m_program->bind();
+  m_program->setUniformValue("mvp", mvp);
+  m_program->setUniformValue("size", QVector2D(m_w, m_h));
+  m_program->setUniformValue("lowerDB", (GLfloat)m_lower_dB);
+  m_program->setUniformValue("upperDB", (GLfloat)m_upper_dB);
+  m_program->setUniformValue("gamma", (GLfloat)m_gamma);
+  m_program->setUniformValue("freqScale", m_freqScale);
+  m_program->setUniformValue("nBins", (GLfloat)m_nBins);
+  m_program->setUniformValue("fsHalf", (GLfloat)(m_fs / 2.0));
+  m_program->setUniformValue("scaleHi", (GLfloat)scaleHi(m_freqScale, m_fs));
+  m_program->setUniformValue("binsPerOctave", (GLfloat)m_binsPerOctave);
+  m_program->setUniformValue("fMin", (GLfloat)m_fMin);
+  m_program->setUniformValue("magTex", 0);
+  m_program->setUniformValue("lutTex", 1);
+  m_magTex->bind(0);
+  m_lutTex->bind(1);
+  m_program->enableAttributeArray(0);
+  m_program->setAttributeArray(0, GL_FLOAT, vertices, 2);
+  f->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  m_program->disableAttributeArray(0);
+  m_lutTex->release(1);
+  m_magTex->release(0);
+  f->glActiveTexture(GL_TEXTURE0);
+  m_program->release();
+}
+
+void TFMapItem::paintSoftware(QPainter *painter) {
+  if (!m_quantDirty.empty()) {
+    m_quant.resize(m_dB.size());
+    int i0 = m_quantDirty.begin;
+    int i1 = min(m_quantDirty.end, m_nFrames);
+    for (int k = 0; k < m_nBins; k++) {
+      size_t row = (size_t)k * m_nFrames;
+      for (int i = i0; i < i1; i++) {
+        double q = (m_dB[row + i] - quantMin_dB) / quantStep_dB;
+        m_quant[row + i] = (unsigned short)min(max(q, 0.0), 65535.0);
+      }
+    }
+    m_quantDirty.clear();
+    if (!m_imageDirty && !m_remapDirty) {
+      fillImage(i0, i1);
+    }
+  }
+  if (m_remapDirty) {
+    m_remap.resize(65536 * 3);
+    double range = m_upper_dB - m_lower_dB;
+    for (int q = 0; q < 65536; q++) {
+      double dB = quantMin_dB + q * quantStep_dB;
+      double x = pow(min(max((dB - m_lower_dB) / range, 0.0), 1.0), m_gamma);
+      int idx = (int)(x * 255.0 + 0.5);
+      memcpy(m_remap.data() + q * 3, m_lut.constScanLine(0) + idx * 3, 3);
+    }
+    m_remapDirty = false;
+    m_imageDirty = true;
+  }
+  if (m_imageDirty) {
+    if (m_image.width() != m_nFrames || m_image.height() != m_h) {
+      m_image = QImage(m_nFrames, m_h, QImage::Format_RGB888);
+    }
+    fillImage(0, m_nFrames);
+    m_imageDirty = false;
+  }
+  PROFILE_SCOPE("Image draw");
+  painter->drawImage(boundingRect(), m_image);
+}
+
+// Columns i0 .. i1 - 1 of the image from the quantized data.
+void TFMapItem::fillImage(int i0, int i1) {
+  PROFILE_SCOPE("Colormap fill");
+  for (int y = 0; y < m_h; y++) {
+    double frac = freqFraction(m_freqScale, (double)y / m_h, m_fs, m_nBins);
+    double pos = frac * m_nBins;
+    if (m_binsPerOctave) {
+      double hz = max(frac * m_fs / 2.0, 1.0);
+      pos = m_binsPerOctave * log2(hz / m_fMin) + 0.5;
+    }
+    int k = min(max((int)pos, 0), m_nBins - 1);
+    const unsigned short *row = m_quant.data() + (size_t)k * m_nFrames;
+    unsigned char *dst = m_image.scanLine(m_h - 1 - y);
+    for (int i = i0; i < i1; i++) {
+      memcpy(dst + i * 3, m_remap.data() + row[i] * 3, 3);
+    }
+  }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <QGraphicsItem>
+#include <QImage>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include <QOpenGLWidget>
+#include <QPainter>
+#include <QPointer>
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+// Spectrogram item. The dB magnitudes are uploaded once as a float texture
+// and the colormap, dB range and frequency-scale mapping are evaluated in a
+// fragment shader, so changing any of them only updates uniforms. When the
+// viewport has no OpenGL context a cached QImage is painted instead; it is
+// built from a quantized copy of the dB data through a remap table, so
+// contrast changes only rebuild the table.
+class TFMapItem : public QGraphicsItem {
+ public:
+  TFMapItem(int w, int h);
+  ~TFMapItem();
+  QRectF boundingRect() const override { return QRectF(0, 0, m_w, m_h); }
+  void paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+             QWidget *widget) override;
+  // Returns the dB buffer to fill, bin-major: [k * nFrames + i] is frame i,
+  // bin k. It is uploaded on the next paint.
+  float *resizeMagnitude(int nFrames, int nBins);
+  float *magnitude() { return m_dB.data(); }
+  // Frames i0 .. i1 - 1 of the dB buffer were rewritten; only their
+  // columns are uploaded or requantized on the next paint.
+  void magnitudeChanged(int i0, int i1);
+  void setRange(double lower_dB, double upper_dB);
+  void setGamma(double gamma);
+  void setFreqScale(int type, double fs);
+  // Bins are linear up to fs / 2 unless binsPerOctave is nonzero; then bin
+  // k is at fMin * 2^(k / binsPerOctave).
+  void setBinAxis(double fMin, int binsPerOctave);
+  static double freqFraction(int type, double v, double fs, int nBins);
+
+ private:
+  bool initGL();
+  void releaseGL();
+  void paintGL(QPainter *painter);
+  void paintSoftware(QPainter *painter);
+  void uploadTexture();
+  void fillImage(int i0, int i1);
+  // Frames begin .. end - 1, widened by every add().
+  struct FrameRange {
+    int begin = 0;
+    int end = 0;
+    bool empty() const { return begin >= end; }
+    void add(int i0, int i1) {
+      if (empty()) {
+        begin = i0;
+        end = i1;
+      } else {
+        begin = min(begin, i0);
+        end = max(end, i1);
+      }
+    }
+    void clear() { begin = end = 0; }
+  };
+  int m_w;
+  int m_h;
+  vector<float> m_dB;
+  // Max-pooled copy of m_dB for textures above the size limit.
+  vector<float> m_pooled;
+  int m_nFrames = 0;
+  int m_nBins = 0;
+  double m_lower_dB = -120.0;
+  double m_upper_dB = 0.0;
+  double m_gamma = 1.0;
+  int m_freqScale = 0;
+  double m_fs = 44100.0;
+  double m_fMin = 0.0;
+  int m_binsPerOctave = 0;
+  QImage m_lut;
+  QImage m_image;
+  static constexpr double quantMin_dB = -320.0;
+  static constexpr double quantStep_dB = 384.0 / 65536.0;
+  vector<unsigned short> m_quant;
+  vector<unsigned char> m_remap;
+  FrameRange m_quantDirty;
+  bool m_remapDirty = true;
+  bool m_imageDirty = true;
+  FrameRange m_textureDirty;
+  bool m_glFailed = false;
+  QPointer<QOpenGLWidget> m_glWidget;
+  QOpenGLShaderProgram *m_program = nullptr;
+  QOpenGLTexture *m_magTex = nullptr;
+  QOpenGLTexture *m_lutTex = nullptr;
+};
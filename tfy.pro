@@ -1,25 +1,55 @@
-QT       += core gui multimedia
+QT       += core gui multimedia opengl
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 5): QT += openglwidgets
 
 CONFIG += c++17
 
+# Element-wise loops such as the dB kernel only vectorize at -O3 with GCC.
+QMAKE_CXXFLAGS_RELEASE -= -O2
+QMAKE_CXXFLAGS_RELEASE += -O3
+# omp simd reductions without the OpenMP runtime, and sqrt() without errno
+# so loops calling it vectorize.
+QMAKE_CXXFLAGS += -fopenmp-simd -fno-math-errno
+
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    batch.cpp \
+    cqt.cpp \
+    events.cpp \
+    exporter.cpp \
+    features.cpp \
     fft.cpp \
     main.cpp \
     mainwindow.cpp \
     playback.cpp \
-    sound.cpp
+    profiler.cpp \
+    resynth.cpp \
+    sliceview.cpp \
+    sound.cpp \
+    tfmap.cpp
 
 HEADERS += \
+    batch.hpp \
+    buffer.hpp \
+    codelet.hpp \
+    cqt.hpp \
+    decibel.hpp \
+    events.hpp \
+    exporter.hpp \
+    features.hpp \
     fft.hpp \
     mainwindow.hpp \
+    mel.hpp \
     playback.hpp \
-    sound.hpp
+    profiler.hpp \
+    resynth.hpp \
+    sliceview.hpp \
+    sound.hpp \
+    tfmap.hpp
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin